@@ -0,0 +1,336 @@
+#include "batch.h"
+
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <limits>
+#include <map>
+#include <memory>
+#include <set>
+#include <sstream>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+#include "reference.h"
+#include "runner.h"
+#include "tests.h"
+
+using namespace convsim;
+using namespace convsim::batch;
+using namespace convsim::tests;
+
+namespace {
+
+// bump whenever a simulator change makes cached results stale
+const char *model_version = "convsim-batch-3";
+
+const double default_clk_period = 10;
+
+template <size_t Rows, size_t Cols>
+function<testbench *()> conv_job(const reference::conv_shape &shape, unsigned seed) {
+    typedef pe_cluster_conv<uint8_t, uint8_t, uint32_t, Rows, Cols> tb;
+
+    if (!tb::fits(shape)) {
+        throw runtime_error("layer doesn't fit a " + to_string(Rows) + "x" + to_string(Cols) + " array");
+    }
+
+    return [shape, seed]() { return new tb("tb", true, true, shape, seed); };
+}
+
+// fields a job and its layer may set, anything else is rejected rather than silently ignored
+const set<string> job_fields = {"id", "array", "layer", "seed", "clk_period_ns"};
+const set<string> layer_fields = {"ifmap_h", "ifmap_w", "kernel_h", "kernel_w", "batch", "channels", "filters"};
+
+void check_fields(const json::value &v, const set<string> &known, const string &what) {
+    if (v.t != json::OBJECT) throw runtime_error(what + " is not an object");
+
+    for (auto &f : v.obj) {
+        if (!known.count(f.first)) throw runtime_error("unknown " + what + " field \"" + f.first + "\"");
+    }
+}
+
+// batch (images), channels and filters are optional
+reference::conv_shape layer_shape(const json::value &job) {
+    const json::value &layer = job.at("layer");
+    reference::conv_shape shape;
+
+    check_fields(layer, layer_fields, "layer");
+
+    shape.ifmap_h = layer.at("ifmap_h").as_size();
+    shape.ifmap_w = layer.at("ifmap_w").as_size();
+    shape.kernel_h = layer.at("kernel_h").as_size();
+    shape.kernel_w = layer.at("kernel_w").as_size();
+    shape.batch = layer.get_size("batch", 1);
+    shape.channels = layer.get_size("channels", 1);
+    shape.filters = layer.get_size("filters", 1);
+
+    return shape;
+}
+
+// the configuration a job simulates: every field with its default filled in, and no id
+json::value resolve_job(const json::value &job) {
+    check_fields(job, job_fields, "job");
+
+    const string &array = job.at("array").as_string();
+    if (!known_array(array)) throw runtime_error("unsupported array \"" + array + "\"");
+
+    const reference::conv_shape shape = layer_shape(job);
+    json::value config;
+
+    config["array"] = array;
+    config["layer"]["ifmap_h"] = shape.ifmap_h;
+    config["layer"]["ifmap_w"] = shape.ifmap_w;
+    config["layer"]["kernel_h"] = shape.kernel_h;
+    config["layer"]["kernel_w"] = shape.kernel_w;
+    config["layer"]["batch"] = shape.batch;
+    config["layer"]["channels"] = shape.channels;
+    config["layer"]["filters"] = shape.filters;
+    // testbenches seed a mt19937 with an unsigned: wider seeds would hash to different keys and simulate the same
+    const size_t seed = job.get_size("seed", 1);
+    if (seed > numeric_limits<unsigned>::max()) throw runtime_error("seed " + to_string(seed) + " out of range");
+
+    config["seed"] = static_cast<unsigned>(seed);
+    config["clk_period_ns"] = job.get_number("clk_period_ns", default_clk_period);
+
+    return config;
+}
+
+// builds the testbench of a resolved job
+function<testbench *()> job_testbench(const json::value &config) {
+    const string &array = config.at("array").as_string();
+    const unsigned seed = static_cast<unsigned>(config.at("seed").as_size());
+    const reference::conv_shape shape = layer_shape(config);
+
+    // resolve_job has already rejected unsupported arrays
+    return with_array(array, [&](auto a) { return conv_job<decltype(a)::rows, decltype(a)::cols>(shape, seed); });
+}
+
+size_t job_macs(const json::value &config) {
+    return layer_shape(config).macs();
+}
+
+struct job_entry {
+    json::value id;
+    // as written in the jobs file, and resolved
+    json::value job;
+    json::value config;
+    string key;
+};
+
+class result_store {
+public:
+    explicit result_store(const string &dir) : dir(dir) {
+        filesystem::create_directories(dir);
+    }
+
+    // entries hold the resolved configuration next to the result: an entry for another configuration (a key
+    // collision) is a miss, and gets overwritten once the job is simulated
+    bool lookup(const string &key, const json::value &config, json::value &result) const {
+        ifstream in(path(key));
+        if (!in) return false;
+
+        stringstream text;
+        text << in.rdbuf();
+
+        try {
+            const json::value entry = json::parse(text.str());
+            if (!entry.has("config") || entry.at("config").dump() != config.dump()) return false;
+
+            result = entry.at("result");
+        } catch (exception &) {
+            // a damaged entry is just a miss
+            return false;
+        }
+
+        return true;
+    }
+
+    void store(const string &key, const json::value &config, const json::value &result) const {
+        // write then rename, so concurrent sweeps never see partial entries
+        const string tmp = path(key) + ".tmp" + to_string(getpid());
+
+        json::value entry;
+        entry["config"] = config;
+        entry["result"] = result;
+
+        ofstream(tmp) << entry.dump() << endl;
+        filesystem::rename(tmp, path(key));
+    }
+
+    string log_path(const string &key) const {
+        return dir + "/" + key + ".log";
+    }
+
+private:
+    string path(const string &key) const {
+        return dir + "/" + key + ".json";
+    }
+
+    string dir;
+};
+
+}
+
+string convsim::batch::job_key(const json::value &job) {
+    // 64-bit FNV-1a of the canonical dump
+    const string text = string(model_version) + ":" + resolve_job(job).dump();
+    uint64_t hash = 14695981039346656037ull;
+
+    for (unsigned char c : text) {
+        hash ^= c;
+        hash *= 1099511628211ull;
+    }
+
+    ostringstream os;
+    os << hex << setw(16) << setfill('0') << hash;
+    return os.str();
+}
+
+size_t convsim::batch::run(const options &opts) {
+    ifstream in(opts.jobs_path);
+    if (!in) throw runtime_error("cannot read jobs file " + opts.jobs_path);
+
+    ofstream out(opts.out_path);
+    if (!out) throw runtime_error("cannot write results file " + opts.out_path);
+
+    result_store cache(opts.cache_dir);
+    size_t failed = 0;
+
+    auto emit = [&](const job_entry &e, const json::value &result, bool cached) {
+        json::value line;
+        line["id"] = e.id;
+        line["key"] = e.key;
+        line["cached"] = cached;
+        line["job"] = e.job;
+        line["result"] = result;
+
+        if (!result.get_bool("passed", false)) failed++;
+
+        out << line.dump() << endl;
+    };
+
+    auto emit_error = [&](const json::value &id, const string &what) {
+        json::value line;
+        line["id"] = id;
+        line["error"] = what;
+
+        failed++;
+
+        out << line.dump() << endl;
+    };
+
+    // jobs to simulate, grouped by key so that duplicates run once
+    map<string, vector<job_entry>> pending;
+    vector<string> order;
+    size_t line_no = 0, hits = 0;
+
+    for (string line; getline(in, line);) {
+        line_no++;
+        if (line.find_first_not_of(" \t\r") == string::npos) continue;
+
+        json::value id = line_no;
+
+        try {
+            job_entry e;
+            e.job = json::parse(line);
+            e.id = e.job.has("id") ? e.job.at("id") : id;
+            id = e.id;
+            e.config = resolve_job(e.job);
+            e.key = job_key(e.job);
+
+            json::value result;
+
+            if (cache.lookup(e.key, e.config, result)) {
+                hits++;
+                emit(e, result, true);
+                continue;
+            }
+
+            // validate before queueing
+            job_testbench(e.config);
+
+            if (pending[e.key].empty()) order.push_back(e.key);
+            pending[e.key].push_back(e);
+        } catch (exception &ex) {
+            emit_error(id, ex.what());
+        }
+    }
+
+    const size_t workers = opts.workers > 0 ? opts.workers : max(1u, thread::hardware_concurrency());
+
+    cerr << "Batch " << opts.jobs_path << ": " << hits << " cached, " << order.size() << " to simulate on "
+         << workers << " workers" << endl;
+
+    // worker pool: one child process per job
+    map<int, pair<string, unique_ptr<child_process>>> running;
+    size_t next = 0;
+
+    while (next < order.size() || !running.empty()) {
+        while (running.size() < workers && next < order.size()) {
+            const string &key = order[next++];
+            const json::value &config = pending[key].front().config;
+            const double clk_period = config.at("clk_period_ns").as_number();
+
+            const function<string()> sim = testbench_job(job_testbench(config), clk_period);
+            const string log = cache.log_path(key);
+
+            // simulator traces go to a per-job log instead of the console
+            auto child = unique_ptr<child_process>(new child_process([sim, log]() {
+                const int fd = open(log.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+                if (fd >= 0) {
+                    dup2(fd, STDERR_FILENO);
+                    close(fd);
+                }
+
+                return sim();
+            }));
+            const int fd = child->fd();
+
+            running[fd] = make_pair(key, move(child));
+        }
+
+        vector<pollfd> fds;
+        for (auto &r : running) fds.push_back({r.first, POLLIN, 0});
+
+        if (poll(fds.data(), fds.size(), -1) < 0) {
+            if (errno == EINTR) continue;
+            throw runtime_error(string("poll failed: ") + strerror(errno));
+        }
+
+        for (auto &p : fds) {
+            if (!p.revents) continue;
+
+            auto it = running.find(p.fd);
+            if (it->second.second->read_output()) continue;
+
+            // the child is done
+            const string key = it->second.first;
+            const child_result child = it->second.second->join();
+            running.erase(it);
+
+            json::value result = testbench_report(child);
+            const double wall = result.get_number("wall_s", 0);
+            const size_t macs = job_macs(pending[key].front().config);
+
+            result["macs"] = macs;
+            result["cycles_per_s"] = wall > 0 ? result.get_number("cycles", 0) / wall : 0;
+            result["macs_per_s"] = wall > 0 ? macs / wall : 0;
+
+            // crashed children are not cached, they may be transient failures
+            if (child.ok) cache.store(key, pending[key].front().config, result);
+
+            for (auto &e : pending[key]) emit(e, result, false);
+        }
+    }
+
+    return failed;
+}
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <string>
+
+#include "json.h"
+
+namespace convsim {
+namespace batch {
+
+using namespace std;
+
+// batch simulation mode: jobs are read from a JSONL file, one JSON object per line, e.g.
+// {"id": "l1", "array": "12x14", "layer": {"ifmap_h": 25, "ifmap_w": 64, "kernel_h": 12, "kernel_w": 3}, "seed": 1}
+// layers may also set "batch" (images streamed per filter), "channels" (accumulated over passes) and "filters",
+// all 1 by default, jobs "clk_period_ns" (10 by default) and a 32-bit "seed" (1 by default); unknown fields are
+// errors
+// the resolved configuration of every job (defaults filled in, id dropped) is hashed: results of known hashes come
+// from the on-disk cache (if the cached configuration matches too), the others are simulated by a pool of worker processes, and every result is appended to
+// the output JSONL as soon as it is available
+struct options {
+    string jobs_path;
+    string out_path;
+    string cache_dir = ".convsim_cache";
+    // 0 means one worker per hardware thread
+    size_t workers = 0;
+};
+
+// content address of a job: the same for jobs that simulate the same configuration, however they spell it
+string job_key(const json::value &job);
+
+// returns the number of failed jobs
+size_t run(const options &opts);
+
+}
+}
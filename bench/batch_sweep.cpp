@@ -0,0 +1,109 @@
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <systemc>
+
+#include "json.h"
+#include "runner.h"
+#include "tests.h"
+
+using namespace std;
+using namespace sc_core;
+
+using namespace convsim;
+using namespace convsim::tests;
+
+// batch size sweep: simulates a full-array convolution with several filters over batches of N images, streamed
+// back to back for each filter so that weights stay resident across the batch, and reports how throughput and
+// weight traffic change with N
+
+namespace {
+
+const double clk_period = 10;
+
+struct options : tool_options {
+    size_t kernel_w = 3;
+    size_t ifmap_w = 32;
+    size_t filters = 4;
+    vector<size_t> batches = {1, 2, 4, 8, 16, 32};
+};
+
+template <size_t Rows, size_t Cols>
+json::value sweep_point(const options &opts, size_t batch) {
+    typedef pe_cluster_conv<uint8_t, uint8_t, uint32_t, Rows, Cols> tb;
+
+    reference::conv_shape shape = full_array_conv<Rows, Cols>(opts.kernel_w, opts.ifmap_w);
+    shape.filters = opts.filters;
+    shape.batch = batch;
+
+    if (!tb::fits(shape)) {
+        throw runtime_error("the convolution doesn't fit a " + opts.array + " array");
+    }
+
+    auto make = [shape]() { return new tb("tb", true, true, shape, 1); };
+    auto report = [](testbench *t, const sc_clock &, json::value &out) {
+        out["weight_loads"] = static_cast<tb *>(t)->weight_loads();
+    };
+
+    json::value r = testbench_report(run_in_child(testbench_job(make, clk_period, report)));
+
+    const double cycles = r.get_number("cycles", 0);
+
+    r["batch"] = batch;
+    r["macs"] = shape.macs();
+    r["macs_per_cycle"] = cycles > 0 ? shape.macs() / cycles : 0;
+    r["weight_loads_per_image"] = r.get_number("weight_loads", 0) / batch;
+
+    return r;
+}
+
+}
+
+int sc_main(int argc, char *argv[]) {
+    options opts;
+
+    auto option = [&opts](const string &name, const string &value) {
+        if (name == "--kernel-w") opts.kernel_w = stoul(value);
+        else if (name == "--ifmap-w") opts.ifmap_w = stoul(value);
+        else if (name == "--filters") opts.filters = stoul(value);
+        else if (name == "--batches") opts.batches = parse_sizes(value);
+        else return false;
+
+        return true;
+    };
+
+    if (!parse_tool_options(argc, argv, true, "[--kernel-w N] [--ifmap-w N] [--filters M] [--batches N,N,...]",
+                            opts, option)) {
+        return 2;
+    }
+
+    json::value points = json::value::array();
+    bool passed = true;
+
+    for (size_t n : opts.batches) {
+        json::value r = with_array(opts.array, [&](auto a) {
+            return sweep_point<decltype(a)::rows, decltype(a)::cols>(opts, n);
+        });
+
+        if (!r.at("passed").as_bool()) {
+            cerr << "Sweep batch " << n << " FAILED!!!" << endl;
+            passed = false;
+        } else {
+            cerr << "Sweep batch " << n << ": " << r.at("cycles").as_number() << " cycles, "
+                 << r.at("macs_per_cycle").as_number() << " MACs/cycle, " << r.at("weight_loads").as_number()
+                 << " PE weight loads (" << r.at("weight_loads_per_image").as_number() << " per image)" << endl;
+        }
+
+        points.push_back(r);
+    }
+
+    json::value result;
+    result["array"] = opts.array;
+    result["filters"] = opts.filters;
+    result["points"] = points;
+
+    write_output(result.dump() + "\n", opts.out_path);
+
+    return passed ? 0 : 1;
+}
@@ -0,0 +1,284 @@
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <systemc>
+
+#include "json.h"
+#include "runner.h"
+#include "tests.h"
+
+using namespace std;
+using namespace sc_core;
+
+using namespace convsim;
+using namespace convsim::tests;
+
+namespace {
+
+const double clk_period = 10;
+
+// scenarios shorter than this are too noisy to gate on throughput
+const double min_timed_wall_s = 0.05;
+
+struct scenario {
+    string name;
+    // elaborates the scenario testbench (as first and last one), in the child process
+    function<testbench *()> make;
+    // multiply-accumulates performed by the scenario
+    size_t macs;
+    // PEs of the array, for the MAC utilization (0 when it doesn't apply)
+    size_t pes = 0;
+};
+
+// a mapping mode that has to keep the array about as busy as the dense convolution does: its MAC utilization must
+// reach a fraction of the one of a dense scenario on the same array
+struct utilization_floor {
+    string name;
+    string dense;
+    double fraction;
+};
+
+const vector<utilization_floor> utilization_floors = {
+    // depthwise groups are stacked down the array, the rest is the pipeline fill of short ifmap rows
+    {"depthwise_12x14", "conv_12x14", 0.75},
+};
+
+// a convolution filling the whole array: one kernel row per PE row, one ofmap row per PE column
+// with several channels, one pass per channel, psums spilled and reinjected between passes
+template <size_t Rows, size_t Cols>
+scenario conv_scenario(size_t kernel_w, size_t ifmap_w, size_t channels = 1) {
+    reference::conv_shape shape = full_array_conv<Rows, Cols>(kernel_w, ifmap_w);
+    shape.channels = channels;
+
+    return {
+        "conv_" + to_string(Rows) + "x" + to_string(Cols) + (channels > 1 ? "_c" + to_string(channels) : ""),
+        [shape]() { return new pe_cluster_conv<uint8_t, uint8_t, uint32_t, Rows, Cols>("tb", true, true, shape, 1); },
+        shape.macs(), Rows * Cols
+    };
+}
+
+// a depthwise, pointwise or fully-connected layer in its own mapping mode
+template <size_t Rows, size_t Cols>
+scenario layer_scenario(const string &name, layer_kind kind, const reference::conv_shape &shape) {
+    typedef pe_cluster_layer<uint8_t, uint8_t, uint32_t, Rows, Cols> tb;
+
+    return {
+        name + "_" + to_string(Rows) + "x" + to_string(Cols),
+        [kind, shape]() { return new tb("tb", true, true, kind, shape, 1); },
+        kind == DEPTHWISE ? shape.macs() / shape.filters : shape.macs(), Rows * Cols
+    };
+}
+
+reference::conv_shape layer_shape(size_t batch, size_t channels, size_t filters, size_t ifmap_h, size_t ifmap_w,
+                                  size_t kernel) {
+    reference::conv_shape shape;
+
+    shape.batch = batch;
+    shape.channels = channels;
+    shape.filters = filters;
+    shape.ifmap_h = ifmap_h;
+    shape.ifmap_w = ifmap_w;
+    shape.kernel_h = kernel;
+    shape.kernel_w = kernel;
+
+    return shape;
+}
+
+vector<scenario> scenarios() {
+    return {
+        {"router_tb", []() { return new router_tb("tb", true, true); }, 0},
+        {"pe_cluster_tb", []() { return new pe_cluster_tb("tb", true, true); }, 1},
+        conv_scenario<4, 4>(3, 512),
+        conv_scenario<12, 14>(3, 128),
+        conv_scenario<12, 14>(3, 32, 4),
+        conv_scenario<32, 32>(3, 32),
+        layer_scenario<12, 14>("depthwise", DEPTHWISE, layer_shape(1, 8, 1, 9, 32, 3)),
+        layer_scenario<12, 14>("pointwise", POINTWISE, layer_shape(1, 24, 28, 8, 8, 1)),
+        layer_scenario<12, 14>("fc", FULLY_CONNECTED, layer_shape(8, 120, 10, 1, 1, 1)),
+        // sc_fifo against spsc_fifo on the same traffic
+        {"fifo_microbench", []() { return new fifo_microbench("tb", true, true); }, 0},
+    };
+}
+
+json::value run_scenario(const scenario &s) {
+    json::value result = testbench_report(run_in_child(testbench_job(s.make, clk_period)));
+
+    const double wall = result.get_number("wall_s", 0);
+
+    result["name"] = s.name;
+    result["macs"] = s.macs;
+    result["cycles_per_s"] = wall > 0 ? result.get_number("cycles", 0) / wall : 0;
+    result["macs_per_s"] = wall > 0 ? s.macs / wall : 0;
+
+    const double cycles = result.get_number("cycles", 0);
+    if (s.pes > 0) result["mac_utilization"] = cycles > 0 ? s.macs / (cycles * s.pes) : 0;
+
+    return result;
+}
+
+// one scenario per line, so that baselines diff nicely
+string format(const json::value &results) {
+    ostringstream os;
+
+    os << "{\n  \"clock_period_ns\": " << clk_period << ",\n  \"scenarios\": [\n";
+    for (size_t i = 0; i < results.arr.size(); i++) {
+        os << "    " << results.arr[i].dump() << (i + 1 < results.arr.size() ? "," : "") << "\n";
+    }
+    os << "  ]\n}\n";
+
+    return os.str();
+}
+
+const json::value *find_scenario(const json::value &list, const string &name) {
+    for (auto &s : list.arr) {
+        if (s.at("name").as_string() == name) return &s;
+    }
+
+    return nullptr;
+}
+
+// a baseline scenario that didn't run (unless filtered out with --only) fails the check, so that renaming or
+// dropping a scenario can't silently skip it; a scenario without a baseline is only warned about
+bool check_baseline(const json::value &results, const json::value &baseline, double tolerance, const string &only) {
+    bool ok = true;
+
+    for (auto &r : results.arr) {
+        const string &name = r.at("name").as_string();
+
+        if (!find_scenario(baseline.at("scenarios"), name)) {
+            cerr << "WARNING " << name << ": no baseline, not checked (add it to the baseline)" << endl;
+        }
+    }
+
+    for (auto &base : baseline.at("scenarios").arr) {
+        const string &name = base.at("name").as_string();
+        const json::value *res = find_scenario(results, name);
+
+        if (!only.empty() && name != only) continue;
+
+        if (!res) {
+            cerr << "MISSING " << name << ": in the baseline but not run" << endl;
+            ok = false;
+            continue;
+        }
+
+        const double cycles = res->get_number("cycles", 0);
+        const double base_cycles = base.at("cycles").as_number();
+
+        if (cycles > base_cycles) {
+            cerr << "REGRESSION " << name << ": " << cycles << " simulated cycles, baseline " << base_cycles << endl;
+            ok = false;
+        } else if (cycles < base_cycles) {
+            cerr << "Improvement " << name << ": " << cycles << " simulated cycles, baseline " << base_cycles
+                 << " (consider updating the baseline)" << endl;
+        }
+
+        if (base.at("wall_s").as_number() < min_timed_wall_s) continue;
+
+        const double throughput = res->get_number("cycles_per_s", 0);
+        const double base_throughput = base.at("cycles_per_s").as_number();
+
+        if (throughput < base_throughput * (1 - tolerance)) {
+            cerr << "REGRESSION " << name << ": " << throughput << " simulated cycles/s, baseline "
+                 << base_throughput << endl;
+            ok = false;
+        }
+    }
+
+    return ok;
+}
+
+// scenarios filtered out with --only are not checked
+bool check_utilization(const json::value &results) {
+    bool ok = true;
+
+    for (auto &u : utilization_floors) {
+        const json::value *res = find_scenario(results, u.name);
+        const json::value *dense = find_scenario(results, u.dense);
+
+        if (!res || !dense) continue;
+
+        const double util = res->get_number("mac_utilization", 0);
+        const double dense_util = dense->get_number("mac_utilization", 0);
+
+        if (util < dense_util * u.fraction) {
+            cerr << "REGRESSION " << u.name << ": " << 100 * util << "% MAC utilization, below " << 100 * u.fraction
+                 << "% of " << u.dense << " (" << 100 * dense_util << "%)" << endl;
+            ok = false;
+        }
+    }
+
+    return ok;
+}
+
+}
+
+int sc_main(int argc, char *argv[]) {
+    tool_options opts;
+    string only, baseline_path, write_baseline_path;
+    double tolerance = 0.25;
+
+    auto option = [&](const string &name, const string &value) {
+        if (name == "--only") only = value;
+        else if (name == "--baseline") baseline_path = value;
+        else if (name == "--tolerance") tolerance = stod(value);
+        else if (name == "--write-baseline") write_baseline_path = value;
+        else return false;
+
+        return true;
+    };
+
+    if (!parse_tool_options(argc, argv, false,
+                            "[--only NAME] [--baseline FILE] [--tolerance FRACTION] [--write-baseline FILE]", opts,
+                            option)) {
+        return 2;
+    }
+
+    json::value results = json::value::array();
+    bool passed = true;
+
+    for (auto &s : scenarios()) {
+        if (!only.empty() && s.name != only) continue;
+
+        json::value r = run_scenario(s);
+
+        cerr << "Benchmark " << s.name << ": " << r.get_number("cycles", 0) << " cycles in "
+             << r.get_number("wall_s", 0) << " s, " << r.at("cycles_per_s").as_number() << " cycles/s, "
+             << r.at("macs_per_s").as_number() << " MACs/s, " << r.at("peak_rss_kb").as_number() << " kB peak RSS"
+             << endl;
+
+        if (!r.at("passed").as_bool()) {
+            cerr << "Benchmark " << s.name << " FAILED!!!" << endl;
+            passed = false;
+        }
+
+        results.push_back(r);
+    }
+
+    if (!check_utilization(results)) passed = false;
+
+    const string report = format(results);
+
+    write_output(report, opts.out_path);
+
+    if (!write_baseline_path.empty()) write_output(report, write_baseline_path);
+
+    if (!baseline_path.empty()) {
+        ifstream in(baseline_path);
+        if (!in) {
+            cerr << "cannot read baseline " << baseline_path << endl;
+            return 1;
+        }
+
+        stringstream text;
+        text << in.rdbuf();
+
+        if (!check_baseline(results, json::parse(text.str()), tolerance, only)) passed = false;
+    }
+
+    return passed ? 0 : 1;
+}
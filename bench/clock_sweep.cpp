@@ -0,0 +1,135 @@
+#include <cmath>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <systemc>
+
+#include "json.h"
+#include "runner.h"
+#include "tests.h"
+
+using namespace std;
+using namespace sc_core;
+
+using namespace convsim;
+using namespace convsim::tests;
+
+// NoC clock sweep: simulates a full-array convolution with the array at a fixed clock and the NoC (with the global
+// buffer) at each of the given clock periods, reporting the utilization of both domains, and finds the slowest NoC
+// clock that doesn't throttle the array
+
+namespace {
+
+struct options : tool_options {
+    size_t kernel_w = 3;
+    size_t ifmap_w = 64;
+    double array_period = 10;
+    vector<double> noc_periods = {5, 7.5, 10, 12.5, 15, 20, 25, 30, 40};
+    double tolerance = 0;
+};
+
+template <size_t Rows, size_t Cols>
+json::value sweep_point(const options &opts, double noc_period) {
+    typedef clock_domain_conv<uint8_t, uint8_t, uint32_t, Rows, Cols> tb;
+
+    const reference::conv_shape shape = full_array_conv<Rows, Cols>(opts.kernel_w, opts.ifmap_w);
+
+    if (!tb::fits(shape)) {
+        throw runtime_error("the convolution doesn't fit a " + opts.array + " array");
+    }
+
+    auto make = [shape, noc_period]() {
+        // lives until the child exits, as the testbench
+        sc_clock *noc_clk = new sc_clock("noc_clk", noc_period, SC_NS);
+        tb *t = new tb("tb", true, true, shape, 1);
+
+        t->noc_clk(*noc_clk);
+        return t;
+    };
+
+    auto report = [](testbench *t, const sc_clock &, json::value &out) {
+        const tb *cd = static_cast<tb *>(t);
+
+        out["noc_cycles"] = cd->noc_cycles();
+        out["noc_flits"] = cd->noc_flits();
+        out["noc_utilization"] = cd->noc_utilization();
+        out["pe_utilization"] = cd->pe_utilization();
+    };
+
+    json::value r = testbench_report(run_in_child(testbench_job(make, opts.array_period, report)));
+    r["noc_period_ns"] = noc_period;
+
+    return r;
+}
+
+}
+
+int sc_main(int argc, char *argv[]) {
+    options opts;
+
+    auto option = [&opts](const string &name, const string &value) {
+        if (name == "--kernel-w") opts.kernel_w = stoul(value);
+        else if (name == "--ifmap-w") opts.ifmap_w = stoul(value);
+        else if (name == "--array-period") opts.array_period = stod(value);
+        else if (name == "--noc-periods") opts.noc_periods = parse_numbers(value);
+        else if (name == "--tolerance") opts.tolerance = stod(value);
+        else return false;
+
+        return true;
+    };
+
+    if (!parse_tool_options(argc, argv, true,
+                            "[--kernel-w N] [--ifmap-w N] [--array-period NS] [--noc-periods NS,NS,...]"
+                            " [--tolerance FRACTION]",
+                            opts, option)) {
+        return 2;
+    }
+
+    json::value points = json::value::array();
+    double best_cycles = HUGE_VAL;
+    bool passed = true;
+
+    for (double p : opts.noc_periods) {
+        json::value r = with_array(opts.array, [&](auto a) {
+            return sweep_point<decltype(a)::rows, decltype(a)::cols>(opts, p);
+        });
+
+        if (!r.at("passed").as_bool()) {
+            cerr << "Sweep NoC period " << p << " ns FAILED!!!" << endl;
+            passed = false;
+            continue;
+        }
+
+        cerr << "Sweep NoC period " << p << " ns: " << r.at("cycles").as_number() << " array cycles, "
+             << 100 * r.at("pe_utilization").as_number() << "% PE utilization, "
+             << 100 * r.at("noc_utilization").as_number() << "% router utilization" << endl;
+
+        best_cycles = min(best_cycles, r.at("cycles").as_number());
+        points.push_back(r);
+    }
+
+    // the slowest NoC clock within the tolerance of the best array cycles
+    double slowest = 0;
+    for (auto &r : points.arr) {
+        if (r.at("cycles").as_number() <= floor(best_cycles * (1 + opts.tolerance))) {
+            slowest = max(slowest, r.at("noc_period_ns").as_number());
+        }
+    }
+
+    json::value result;
+    result["array"] = opts.array;
+    result["array_period_ns"] = opts.array_period;
+    result["tolerance"] = opts.tolerance;
+    result["points"] = points;
+
+    if (slowest > 0) {
+        result["slowest_noc_period_ns"] = slowest;
+        cerr << "Slowest NoC clock not throttling the array: " << slowest << " ns (" << 1000 / slowest << " MHz)"
+             << endl;
+    }
+
+    write_output(result.dump() + "\n", opts.out_path);
+
+    return passed ? 0 : 1;
+}
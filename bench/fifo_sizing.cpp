@@ -0,0 +1,236 @@
+#include <cmath>
+#include <iostream>
+#include <map>
+#include <string>
+#include <vector>
+
+#include <systemc>
+
+#include "json.h"
+#include "runner.h"
+#include "tests.h"
+
+using namespace std;
+using namespace sc_core;
+
+using namespace convsim;
+using namespace convsim::tests;
+
+// FIFO depth sizing: simulates a convolution filling the whole array (as the benchmark suite does) with every fifo
+// as deep as possible, then searches the smallest depth of each fifo kind that keeps the total cycles within a
+// tolerance of that (practically unbounded) case
+// all the fifos of a kind share the same depth, per-fifo high-water marks and full-stall cycles are reported too
+
+namespace {
+
+const double clk_period = 10;
+
+// one depth per fifo kind: cluster propagation links and PE pipeline stages
+typedef map<string, size_t> depth_map;
+
+const vector<string> kinds = {"iact", "weight", "psum", "fifo_1to2", "fifo_2to3_act", "fifo_2to3_w"};
+
+struct options : tool_options {
+    size_t kernel_w = 3;
+    size_t ifmap_w = 64;
+    double tolerance = 0.05;
+};
+
+// propagation fifos are named <cluster>.<kind>_<row>_<col>, PE fifos <pe>.<kind>
+string fifo_kind(const string &name) {
+    const string last = name.substr(name.rfind('.') + 1);
+
+    if (last.compare(0, 5, "fifo_") == 0) return last;
+    return last.substr(0, last.find('_'));
+}
+
+template <size_t Rows, size_t Cols>
+class sizer {
+    typedef pe_cluster_conv<uint8_t, uint8_t, uint32_t, Rows, Cols> tb;
+    typedef typename tb::cluster cluster;
+
+public:
+    explicit sizer(const options &opts) : opts(opts), shape(full_array_conv<Rows, Cols>(opts.kernel_w, opts.ifmap_w)) {
+        if (!tb::fits(shape)) {
+            throw runtime_error("the convolution doesn't fit a " + opts.array + " array");
+        }
+    }
+
+    json::value run() {
+        depth_map depths = unbounded_depths();
+        const json::value unbounded = simulate(depths);
+        const double unbounded_cycles = unbounded.at("cycles").as_number();
+        const double target = floor(unbounded_cycles * (1 + opts.tolerance));
+        const depth_map high_water = max_high_water(unbounded);
+
+        for (auto &k : kinds) {
+            if (high_water.at(k) == depths.at(k)) {
+                cerr << "Warning: " << k << " fifos filled up to their capacity, the unbounded case is approximate"
+                     << endl;
+            }
+        }
+
+        // with depths equal to the high-water marks no fifo is ever found full, so the timing doesn't change
+        for (auto &k : kinds) depths[k] = max<size_t>(1, high_water.at(k));
+
+        // then each kind is shrunk in turn, with a bisection over its depth
+        for (auto &k : kinds) {
+            size_t lo = 1, hi = depths[k];
+
+            while (lo < hi) {
+                const size_t mid = (lo + hi) / 2;
+                depth_map trial = depths;
+                trial[k] = mid;
+
+                if (fits_target(simulate(trial), target)) {
+                    hi = mid;
+                } else {
+                    lo = mid + 1;
+                }
+            }
+
+            depths[k] = hi;
+        }
+
+        const json::value sized = simulate(depths);
+
+        json::value result;
+        result["array"] = opts.array;
+        result["layer"]["ifmap_h"] = shape.ifmap_h;
+        result["layer"]["ifmap_w"] = shape.ifmap_w;
+        result["layer"]["kernel_h"] = shape.kernel_h;
+        result["layer"]["kernel_w"] = shape.kernel_w;
+        result["tolerance"] = opts.tolerance;
+        result["simulations"] = cache.size();
+        result["unbounded"]["cycles"] = unbounded_cycles;
+        result["unbounded"]["high_water"] = to_json(high_water);
+        result["sized"]["cycles"] = sized.at("cycles");
+        result["sized"]["depths"] = to_json(depths);
+        result["sized"]["fifos"] = sized.at("fifos");
+
+        if (!fits_target(sized, target)) {
+            throw runtime_error("the sized configuration misses the target, cycles aren't monotonic in the depths");
+        }
+
+        return result;
+    }
+
+private:
+    depth_map unbounded_depths() const {
+        depth_map depths;
+
+        for (auto &k : kinds) {
+            depths[k] = k.compare(0, 5, "fifo_") == 0 ? cluster::pe::max_fifo_depth : cluster::max_fifo_depth;
+        }
+
+        return depths;
+    }
+
+    static bool fits_target(const json::value &r, double target) {
+        return r.at("passed").as_bool() && r.at("cycles").as_number() <= target;
+    }
+
+    static json::value to_json(const depth_map &depths) {
+        json::value v = json::value::object();
+        for (auto &d : depths) v[d.first] = d.second;
+        return v;
+    }
+
+    static depth_map max_high_water(const json::value &r) {
+        depth_map hw;
+
+        for (auto &k : kinds) hw[k] = 0;
+        for (auto &f : r.at("fifos").arr) {
+            size_t &m = hw[fifo_kind(f.at("name").as_string())];
+            m = max(m, f.at("high_water").as_size());
+        }
+
+        return hw;
+    }
+
+    // every configuration is simulated in its own child process, at most once
+    const json::value &simulate(const depth_map &depths) {
+        auto it = cache.find(depths);
+        if (it != cache.end()) return it->second;
+
+        typename cluster::fifo_depths d;
+        d.iact = depths.at("iact");
+        d.weight = depths.at("weight");
+        d.psum = depths.at("psum");
+        d.pe_depths.fifo_1to2 = depths.at("fifo_1to2");
+        d.pe_depths.fifo_2to3_act = depths.at("fifo_2to3_act");
+        d.pe_depths.fifo_2to3_w = depths.at("fifo_2to3_w");
+
+        const reference::conv_shape s = shape;
+        auto make = [s, d]() { return new tb("tb", true, true, s, 1, d); };
+        auto stats = [](testbench *t, const sc_clock &clk, json::value &out) {
+            out["fifos"] = json::value::array();
+
+            for (auto &f : static_cast<tb *>(t)->collect_fifo_stats()) {
+                json::value v;
+                v["name"] = f.name;
+                v["depth"] = f.depth;
+                v["high_water"] = f.high_water;
+                v["full_stall_cycles"] = llround(f.full_stall / clk.period());
+                out["fifos"].push_back(v);
+            }
+        };
+
+        json::value r = testbench_report(run_in_child(testbench_job(make, clk_period, stats)));
+        if (!r.has("cycles")) r["cycles"] = 0;
+        if (!r.has("fifos")) r["fifos"] = json::value::array();
+
+        cerr << "Sizing " << to_json(depths).dump() << ": " << r.at("cycles").as_number() << " cycles"
+             << (r.at("passed").as_bool() ? "" : " FAILED!!!") << endl;
+
+        return cache[depths] = r;
+    }
+
+    const options opts;
+    reference::conv_shape shape;
+    map<depth_map, json::value> cache;
+};
+
+}
+
+int sc_main(int argc, char *argv[]) {
+    options opts;
+
+    auto option = [&opts](const string &name, const string &value) {
+        if (name == "--kernel-w") opts.kernel_w = stoul(value);
+        else if (name == "--ifmap-w") opts.ifmap_w = stoul(value);
+        else if (name == "--tolerance") opts.tolerance = stod(value);
+        else return false;
+
+        return true;
+    };
+
+    if (!parse_tool_options(argc, argv, true, "[--kernel-w N] [--ifmap-w N] [--tolerance FRACTION]", opts, option)) {
+        return 2;
+    }
+
+    const json::value result = with_array(opts.array, [&](auto a) {
+        return sizer<decltype(a)::rows, decltype(a)::cols>(opts).run();
+    });
+
+    const json::value &depths = result.at("sized").at("depths");
+    const json::value &high_water = result.at("unbounded").at("high_water");
+
+    cerr << "Unbounded: " << result.at("unbounded").at("cycles").as_number() << " cycles, sized: "
+         << result.at("sized").at("cycles").as_number() << " cycles (tolerance " << opts.tolerance << ")" << endl;
+
+    for (auto &k : kinds) {
+        size_t stall = 0;
+
+        for (auto &f : result.at("sized").at("fifos").arr) {
+            if (fifo_kind(f.at("name").as_string()) == k) stall += f.at("full_stall_cycles").as_size();
+        }
+
+        cerr << "  " << k << ": depth " << depths.at(k).as_size() << " (unbounded high-water "
+             << high_water.at(k).as_size() << "), " << stall << " full-stall cycles" << endl;
+    }
+
+    write_output(result.dump() + "\n", opts.out_path);
+
+    return 0;
+}
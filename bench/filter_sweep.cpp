@@ -0,0 +1,191 @@
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <systemc>
+
+#include "json.h"
+#include "runner.h"
+#include "tests.h"
+
+using namespace std;
+using namespace sc_core;
+
+using namespace convsim;
+using namespace convsim::tests;
+
+// output channel sweep: simulates layers with an increasing number of filters, each one a weight row switch in
+// every PE, with weights loaded lazily and with double-buffered weights, and reports the layer cycles the shadow
+// weight bank hides
+// - conv: a full-array convolution, each weight row multicast to all the columns; the weight fifos already prefetch
+//   the next filter, so the shadow bank only matters with shallow ones (--weight-depth)
+// - fc: a fully-connected layer, where every column has a filter row of its own, scattered over the weight row
+//   link: filter rows longer than the weight fifos block the link behind a column that hasn't started its next row,
+//   which puts weights on the critical path even at the default depths
+
+namespace {
+
+const double clk_period = 10;
+
+struct options : tool_options {
+    size_t kernel_w = 3;
+    size_t ifmap_w = 16;
+    size_t batch = 1;
+    // fully-connected layer: inputs (features / rows weights per filter row) and images, each one a window per
+    // filter row
+    size_t features = 240;
+    size_t fc_batch = 16;
+    // depth of the weight propagation fifos (0 keeps the default one)
+    size_t weight_depth = 0;
+    vector<size_t> filters = {1, 2, 4, 8, 16, 32};
+};
+
+template <typename cluster>
+typename cluster::fifo_depths sweep_depths(const options &opts) {
+    typename cluster::fifo_depths depths;
+    if (opts.weight_depth > 0) depths.weight = opts.weight_depth;
+
+    return depths;
+}
+
+template <typename tb, typename make_tb>
+json::value run_point(const options &opts, make_tb make_layer, bool double_buffer) {
+    const typename tb::cluster::fifo_depths depths = sweep_depths<typename tb::cluster>(opts);
+
+    auto make = [make_layer, depths, double_buffer]() { return make_layer(depths, double_buffer); };
+    auto report = [](testbench *t, const sc_clock &, json::value &out) {
+        out["weight_stall_cycles"] = static_cast<tb *>(t)->weight_stall_cycles();
+    };
+
+    return testbench_report(run_in_child(testbench_job(make, clk_period, report)));
+}
+
+template <typename tb, typename make_tb>
+json::value sweep_point(const options &opts, size_t filters, make_tb make_layer) {
+    json::value r;
+
+    r["filters"] = filters;
+    r["lazy"] = run_point<tb>(opts, make_layer, false);
+    r["double_buffered"] = run_point<tb>(opts, make_layer, true);
+
+    const double lazy = r.at("lazy").get_number("cycles", 0);
+    const double buffered = r.at("double_buffered").get_number("cycles", 0);
+
+    // cycles of the layer, and PE cycles waiting for weights, that the shadow bank saves
+    r["hidden_cycles"] = lazy - buffered;
+    r["hidden_stall_cycles"] = r.at("lazy").get_number("weight_stall_cycles", 0) -
+                               r.at("double_buffered").get_number("weight_stall_cycles", 0);
+
+    return r;
+}
+
+template <size_t Rows, size_t Cols>
+json::value conv_point(const options &opts, size_t filters) {
+    typedef pe_cluster_conv<uint8_t, uint8_t, uint32_t, Rows, Cols> tb;
+
+    reference::conv_shape shape = full_array_conv<Rows, Cols>(opts.kernel_w, opts.ifmap_w);
+    shape.filters = filters;
+    shape.batch = opts.batch;
+
+    if (!tb::fits(shape)) {
+        throw runtime_error("the convolution doesn't fit a " + opts.array + " array");
+    }
+
+    auto make = [shape](const typename tb::cluster::fifo_depths &depths, bool double_buffer) {
+        return new tb("tb", true, true, shape, 1, depths, double_buffer);
+    };
+
+    return sweep_point<tb>(opts, filters, make);
+}
+
+template <size_t Rows, size_t Cols>
+json::value fc_point(const options &opts, size_t filters) {
+    typedef pe_cluster_layer<uint8_t, uint8_t, uint32_t, Rows, Cols> tb;
+
+    reference::conv_shape shape;
+    shape.batch = opts.fc_batch;
+    shape.channels = opts.features;
+    shape.filters = filters;
+    shape.ifmap_h = shape.ifmap_w = 1;
+    shape.kernel_h = shape.kernel_w = 1;
+
+    if (!tb::fits(FULLY_CONNECTED, shape)) {
+        throw runtime_error("the fully-connected layer doesn't fit a " + opts.array + " array");
+    }
+
+    // a column takes its filter row while the iacts are multicast to all of them: a row that doesn't fit the weight
+    // fifo, with the iact fifo of the next column, blocks both links for good
+    const typename tb::cluster::fifo_depths depths = sweep_depths<typename tb::cluster>(opts);
+
+    if (tb::cluster::pointwise_chunk(shape.channels) > depths.weight + depths.iact) {
+        throw runtime_error("filter rows of " + to_string(tb::cluster::pointwise_chunk(shape.channels)) +
+                            " weights don't fit the weight and iact fifos");
+    }
+
+    auto make = [shape](const typename tb::cluster::fifo_depths &depths, bool double_buffer) {
+        return new tb("tb", true, true, FULLY_CONNECTED, shape, 1, depths, double_buffer);
+    };
+
+    return sweep_point<tb>(opts, filters, make);
+}
+
+}
+
+int sc_main(int argc, char *argv[]) {
+    options opts;
+
+    auto option = [&opts](const string &name, const string &value) {
+        if (name == "--kernel-w") opts.kernel_w = stoul(value);
+        else if (name == "--ifmap-w") opts.ifmap_w = stoul(value);
+        else if (name == "--batch") opts.batch = stoul(value);
+        else if (name == "--features") opts.features = stoul(value);
+        else if (name == "--fc-batch") opts.fc_batch = stoul(value);
+        else if (name == "--weight-depth") opts.weight_depth = stoul(value);
+        else if (name == "--filters") opts.filters = parse_sizes(value);
+        else return false;
+
+        return true;
+    };
+
+    if (!parse_tool_options(argc, argv, true,
+                            "[--kernel-w N] [--ifmap-w N] [--batch N] [--features N] [--fc-batch N] "
+                            "[--weight-depth N] [--filters M,M,...]",
+                            opts, option)) {
+        return 2;
+    }
+
+    json::value result;
+    bool passed = true;
+
+    for (const string layer : {"conv", "fc"}) {
+        json::value points = json::value::array();
+
+        for (size_t m : opts.filters) {
+            json::value r = with_array(opts.array, [&](auto a) {
+                constexpr size_t rows = decltype(a)::rows, cols = decltype(a)::cols;
+                return layer == "conv" ? conv_point<rows, cols>(opts, m) : fc_point<rows, cols>(opts, m);
+            });
+
+            if (!r.at("lazy").at("passed").as_bool() || !r.at("double_buffered").at("passed").as_bool()) {
+                cerr << "Sweep " << layer << " filters " << m << " FAILED!!!" << endl;
+                passed = false;
+            } else {
+                cerr << "Sweep " << layer << " filters " << m << ": " << r.at("hidden_cycles").as_number()
+                     << " layer cycles hidden by double buffering (" << r.at("lazy").at("cycles").as_number()
+                     << " lazy, " << r.at("double_buffered").at("cycles").as_number() << " double buffered), "
+                     << r.at("hidden_stall_cycles").as_number() << " PE weight stall cycles hidden" << endl;
+            }
+
+            points.push_back(r);
+        }
+
+        result[layer] = points;
+    }
+
+    result["array"] = opts.array;
+    result["weight_depth"] = opts.weight_depth;
+
+    write_output(result.dump() + "\n", opts.out_path);
+
+    return passed ? 0 : 1;
+}
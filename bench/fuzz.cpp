@@ -0,0 +1,85 @@
+#include <iostream>
+#include <string>
+
+#include <systemc>
+
+#include "json.h"
+#include "runner.h"
+#include "tests.h"
+
+using namespace std;
+using namespace sc_core;
+
+using namespace convsim;
+using namespace convsim::tests;
+
+// randomized equivalence check: runs the cluster fuzzer (random shapes and data, every psum compared with the
+// reference engine, the reference variants compared with the scalar oracle) on any of the arrays, with as many
+// trials and whatever seed the command line asks for
+
+namespace {
+
+const double clk_period = 10;
+
+struct options : tool_options {
+    size_t trials = 16;
+    unsigned seed = 1;
+};
+
+template <size_t Rows, size_t Cols>
+json::value fuzz(const options &opts) {
+    typedef pe_cluster_fuzz<Rows, Cols> tb;
+
+    const size_t trials = opts.trials;
+    const unsigned seed = opts.seed;
+
+    auto make = [trials, seed]() { return new tb("fuzz", true, true, trials, seed); };
+    auto report = [](testbench *t, const sc_clock &, json::value &out) {
+        const tb *f = static_cast<tb *>(t);
+
+        out["trials"] = f->trials_run();
+        out["trials_passed"] = f->trials_passed();
+        out["reference_mismatches"] = f->reference_mismatches();
+    };
+
+    return testbench_report(run_in_child(testbench_job(make, clk_period, report)));
+}
+
+}
+
+int sc_main(int argc, char *argv[]) {
+    options opts;
+
+    auto option = [&opts](const string &name, const string &value) {
+        if (name == "--trials") opts.trials = stoul(value);
+        else if (name == "--seed") opts.seed = stoul(value);
+        else return false;
+
+        return true;
+    };
+
+    if (!parse_tool_options(argc, argv, true, "[--trials N] [--seed S]", opts, option)) {
+        return 2;
+    }
+
+    json::value result = with_array(opts.array, [&](auto a) {
+        return fuzz<decltype(a)::rows, decltype(a)::cols>(opts);
+    });
+
+    result["array"] = opts.array;
+    result["seed"] = opts.seed;
+
+    const bool passed = result.at("passed").as_bool();
+
+    if (!result.has("trials")) {
+        cerr << "Fuzz " << opts.array << " seed " << opts.seed << " FAILED!!! (the simulation didn't finish)" << endl;
+    } else {
+        cerr << "Fuzz " << opts.array << " seed " << opts.seed << ": " << result.at("trials_passed").as_number()
+             << "/" << opts.trials << " trials passed, " << result.at("reference_mismatches").as_number()
+             << " reference mismatches" << (passed ? "" : " FAILED!!!") << endl;
+    }
+
+    write_output(result.dump() + "\n", opts.out_path);
+
+    return passed ? 0 : 1;
+}
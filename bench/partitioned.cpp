@@ -0,0 +1,166 @@
+#include <algorithm>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <systemc>
+
+#include "json.h"
+#include "partition.h"
+#include "runner.h"
+#include "tests.h"
+
+using namespace std;
+using namespace sc_core;
+
+using namespace convsim;
+using namespace convsim::tests;
+
+// partitioned simulation: simulates a chain of clusters (one input channel each, psums flowing down the chain)
+// first monolithically, then with one process per cluster, checks that both runs take the same cycles and reports
+// the wall time speedup, for each of the cluster counts
+// - the projected speedup is the one a core per partition would give, the monolithic CPU time over the one of the
+//   busiest partition (spinning on its peers included), so it can be measured on any host
+// - with at least a core per partition the wall time has to scale: the speedup over the cluster count (the
+//   parallel efficiency) must reach --min-efficiency
+
+namespace {
+
+const double clk_period = 10;
+
+struct options : tool_options {
+    vector<size_t> clusters = {2, 4, 8};
+    size_t kernel_w = 3;
+    size_t ifmap_w = 64;
+    size_t filters = 2;
+    size_t batch = 1;
+    size_t latency = 4;
+    double min_efficiency = 0.5;
+};
+
+template <size_t Rows, size_t Cols>
+json::value compare(const options &opts, size_t clusters) {
+    typedef cluster_chain_conv<uint8_t, uint8_t, uint32_t, Rows, Cols> tb;
+
+    reference::conv_shape shape = full_array_conv<Rows, Cols>(opts.kernel_w, opts.ifmap_w);
+    shape.channels = clusters;
+    shape.filters = opts.filters;
+    shape.batch = opts.batch;
+
+    if (!tb::fits(shape)) {
+        throw runtime_error("the convolution doesn't fit a " + opts.array + " array");
+    }
+
+    json::value result;
+
+    {
+        // all the clusters in one child
+        partition_set parts(clusters);
+        typename tb::chain_links links(parts, opts.latency);
+
+        auto make = [&shape, &links]() { return new tb("tb", true, true, shape, 1, links); };
+        result["monolithic"] = testbench_report(run_in_child(testbench_job(make, clk_period)));
+    }
+
+    {
+        // one child per cluster, the links go through the shared memory mapped here
+        partition_set parts(clusters);
+        typename tb::chain_links links(parts, opts.latency);
+
+        auto make = [&shape, &links](size_t) { return new tb("tb", true, true, shape, 1, links); };
+        result["partitioned"] = run_partitioned(parts, make, clk_period);
+    }
+
+    return result;
+}
+
+}
+
+int sc_main(int argc, char *argv[]) {
+    options opts;
+
+    auto option = [&opts](const string &name, const string &value) {
+        if (name == "--clusters") opts.clusters = parse_sizes(value);
+        else if (name == "--kernel-w") opts.kernel_w = stoul(value);
+        else if (name == "--ifmap-w") opts.ifmap_w = stoul(value);
+        else if (name == "--filters") opts.filters = stoul(value);
+        else if (name == "--batch") opts.batch = stoul(value);
+        else if (name == "--latency") opts.latency = stoul(value);
+        else if (name == "--min-efficiency") opts.min_efficiency = stod(value);
+        else return false;
+
+        return true;
+    };
+
+    if (!parse_tool_options(argc, argv, true,
+                            "[--clusters K,K,...] [--kernel-w N] [--ifmap-w N] [--filters M] [--batch N] "
+                            "[--latency CYCLES] [--min-efficiency FRACTION]",
+                            opts, option)) {
+        return 2;
+    }
+
+    const size_t cores = thread::hardware_concurrency();
+
+    json::value points = json::value::array();
+    bool passed = true;
+
+    for (size_t k : opts.clusters) {
+        json::value r = with_array(opts.array, [&](auto a) {
+            return compare<decltype(a)::rows, decltype(a)::cols>(opts, k);
+        });
+
+        const json::value &mono = r.at("monolithic");
+        const json::value &part = r.at("partitioned");
+
+        const double mono_wall = mono.get_number("wall_s", 0);
+        const double part_wall = part.get_number("wall_s", 0);
+
+        double busiest_cpu = 0;
+        for (auto &p : part.at("partitions").arr) busiest_cpu = max(busiest_cpu, p.get_number("cpu_s", 0));
+
+        r["clusters"] = k;
+        r["cycles_match"] = mono.get_number("cycles", -1) == part.get_number("cycles", -2);
+        r["speedup"] = part_wall > 0 ? mono_wall / part_wall : 0;
+        r["projected_speedup"] = busiest_cpu > 0 ? mono.get_number("cpu_s", 0) / busiest_cpu : 0;
+        r["efficiency"] = r.at("speedup").as_number() / k;
+        // the wall time can only scale with a core per partition
+        r["scaling_checked"] = cores >= k;
+
+        if (!mono.at("passed").as_bool() || !part.at("passed").as_bool()) {
+            cerr << "Partitioned simulation " << k << " clusters FAILED!!!" << endl;
+            passed = false;
+        } else if (!r.at("cycles_match").as_bool()) {
+            cerr << "Partitioned simulation " << k << " clusters MISMATCH: " << part.at("cycles").as_number()
+                 << " cycles, " << mono.at("cycles").as_number() << " monolithic" << endl;
+            passed = false;
+        } else {
+            cerr << "Partitioned simulation: " << k << " clusters, " << part.at("cycles").as_number()
+                 << " cycles in both runs, " << mono_wall << " s monolithic, " << part_wall << " s partitioned ("
+                 << r.at("speedup").as_number() << "x, " << r.at("projected_speedup").as_number()
+                 << "x projected with a core per partition)" << endl;
+
+            if (!r.at("scaling_checked").as_bool()) {
+                cerr << "Partitioned simulation " << k << " clusters: scaling not checked, " << cores
+                     << " cores" << endl;
+            } else if (r.at("efficiency").as_number() < opts.min_efficiency) {
+                cerr << "Partitioned simulation " << k << " clusters doesn't SCALE: "
+                     << 100 * r.at("efficiency").as_number() << "% parallel efficiency, "
+                     << 100 * opts.min_efficiency << "% required" << endl;
+                passed = false;
+            }
+        }
+
+        points.push_back(r);
+    }
+
+    json::value result;
+    result["array"] = opts.array;
+    result["latency"] = opts.latency;
+    result["cores"] = cores;
+    result["points"] = points;
+
+    write_output(result.dump() + "\n", opts.out_path);
+
+    return passed ? 0 : 1;
+}
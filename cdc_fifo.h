@@ -0,0 +1,168 @@
+#pragma once
+
+#include <systemc>
+
+#include <string>
+#include <vector>
+
+namespace convsim {
+
+using namespace std;
+using namespace sc_core;
+
+// Dual-clock fifo for links between clock domains, modelled after the usual pointer synchronizer design:
+// - the write pointer reaches the read domain through a chain of sync_stages flip-flops clocked by rd_clk, so an
+//   element written is visible to the reader only sync_stages rd_clk edges later
+// - the read pointer reaches the write domain the same way, so a freed slot is visible to the writer only
+//   sync_stages wr_clk edges later
+// the synchronizers sample the pointers as registered at the end of the previous delta (they are published through
+// signals), so a pointer bumped on the same edge as the sampling clock is always seen on the next edge, whatever
+// order the kernel evaluates the processes in
+// the synchronizers go idle when nothing is in flight, so an idle crossing costs no process activations
+template <typename T>
+class cdc_fifo : public sc_module, public sc_fifo_in_if<T>, public sc_fifo_out_if<T> {
+public:
+    // write and read side clocks
+    sc_in<bool> wr_clk;
+    sc_in<bool> rd_clk;
+
+    SC_HAS_PROCESS(cdc_fifo);
+
+    cdc_fifo(sc_module_name name, size_t depth = 16, size_t sync_stages = 2)
+        : sc_module(name), wr_clk("wr_clk"), rd_clk("rd_clk"), buf(depth), wr_ptr_q("wr_ptr_q"),
+          rd_ptr_q("rd_ptr_q"), wr_sync(sync_stages, 0), rd_sync(sync_stages, 0) {
+        if (depth == 0) throw runtime_error(string(this->name()) + " cdc_fifo depth must be positive");
+        if (sync_stages == 0) throw runtime_error(string(this->name()) + " cdc_fifo needs at least one sync stage");
+
+        SC_METHOD(sync_wr_ptr);
+        sensitive << rd_clk.pos();
+
+        SC_METHOD(sync_rd_ptr);
+        sensitive << wr_clk.pos();
+    }
+
+    // blocking interface
+    virtual void read(T &val) override {
+        while (rd_ptr == wr_sync.back()) sc_core::wait(written_event);
+
+        val = buf[rd_ptr % buf.size()];
+        rd_ptr++;
+        rd_ptr_q.write(rd_ptr);
+
+        if (rd_idle) rd_kick.notify(SC_ZERO_TIME);
+    }
+
+    virtual T read() override {
+        T val;
+        read(val);
+        return val;
+    }
+
+    virtual void write(const T &val) override {
+        while (wr_ptr - rd_sync.back() == buf.size()) sc_core::wait(read_event);
+
+        buf[wr_ptr % buf.size()] = val;
+        wr_ptr++;
+        wr_ptr_q.write(wr_ptr);
+
+        if (wr_idle) wr_kick.notify(SC_ZERO_TIME);
+    }
+
+    // non-blocking interface
+    virtual bool nb_read(T &val) override {
+        if (rd_ptr == wr_sync.back()) return false;
+        read(val);
+        return true;
+    }
+
+    virtual bool nb_write(const T &val) override {
+        if (wr_ptr - rd_sync.back() == buf.size()) return false;
+        write(val);
+        return true;
+    }
+
+    // as seen from the reader
+    virtual int num_available() const override {
+        return wr_sync.back() - rd_ptr;
+    }
+
+    // as seen from the writer
+    virtual int num_free() const override {
+        return buf.size() - (wr_ptr - rd_sync.back());
+    }
+
+    virtual const sc_event &data_written_event() const override {
+        return written_event;
+    }
+
+    virtual const sc_event &data_read_event() const override {
+        return read_event;
+    }
+
+    virtual const sc_event &default_event() const override {
+        return written_event;
+    }
+
+    virtual const char *kind() const override {
+        return "cdc_fifo";
+    }
+
+    // elements that went through the crossing
+    uint64_t transfers() const {
+        return rd_ptr;
+    }
+
+private:
+    // read domain: shifts the write pointer through the synchronizer
+    void sync_wr_ptr() {
+        if (sync_step(wr_sync, wr_ptr_q.read(), wr_ptr, wr_idle, wr_kick)) written_event.notify(SC_ZERO_TIME);
+    }
+
+    // write domain: shifts the read pointer through the synchronizer
+    void sync_rd_ptr() {
+        if (sync_step(rd_sync, rd_ptr_q.read(), rd_ptr, rd_idle, rd_kick)) read_event.notify(SC_ZERO_TIME);
+    }
+
+    // one clock edge of a synchronizer chain sampling the registered pointer ptr, returns true if its output changed
+    // it only goes idle once the live pointer has gone through: if the other side bumped it earlier in this delta,
+    // it may not have kicked the chain
+    bool sync_step(vector<uint64_t> &chain, uint64_t ptr, uint64_t live, bool &idle, sc_event &kick) {
+        // woken up by the other domain: the chain samples on the next clock edge
+        if (idle) {
+            idle = false;
+            return false;
+        }
+
+        const uint64_t before = chain.back();
+
+        for (size_t i = chain.size() - 1; i > 0; i--) chain[i] = chain[i - 1];
+        chain[0] = ptr;
+
+        if (chain.back() == live) {
+            idle = true;
+            next_trigger(kick);
+        }
+
+        return chain.back() != before;
+    }
+
+    vector<T> buf;
+    // free running element counters, owned by each side, and as registered for the synchronizers
+    uint64_t wr_ptr = 0;
+    uint64_t rd_ptr = 0;
+    sc_signal<uint64_t> wr_ptr_q;
+    sc_signal<uint64_t> rd_ptr_q;
+    // synchronizer chains, the last stage is what the other side sees
+    vector<uint64_t> wr_sync;
+    vector<uint64_t> rd_sync;
+
+    bool wr_idle = false;
+    bool rd_idle = false;
+    sc_event wr_kick;
+    sc_event rd_kick;
+
+    sc_event written_event;
+    sc_event read_event;
+};
+
+}
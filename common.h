@@ -1,3 +1,26 @@
 #pragma once
 
+#include <systemc>
+
+#include <stdexcept>
+#include <string>
+
+// module traces and configuration dumps, only built with -DCONVSIM_MOD_DBG=ON
+#ifdef CONVSIM_MOD_DBG
 #define MOD_DBG(x) cerr << "module " << name() << " @ " << sc_time_stamp() << ": " << x << endl;
+#else
+#define MOD_DBG(x)
+#endif
+
+namespace convsim {
+
+// period of the clock a port is bound to
+inline sc_core::sc_time clock_period(const sc_core::sc_in<bool> &clk) {
+    const sc_core::sc_clock *c = dynamic_cast<const sc_core::sc_clock *>(clk.get_interface());
+
+    if (!c) throw std::runtime_error(std::string(clk.name()) + " is not bound to an sc_clock");
+
+    return c->period();
+}
+
+}
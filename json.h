@@ -0,0 +1,315 @@
+#pragma once
+
+#include <cmath>
+#include <cstdlib>
+#include <map>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+namespace convsim {
+namespace json {
+
+using namespace std;
+
+typedef enum {
+    NONE, BOOL, NUMBER, STRING, ARRAY, OBJECT
+} type;
+
+// minimal JSON document model, enough for benchmark results and job descriptions
+// objects keep their keys sorted, so dump() is canonical
+struct value {
+    type t = NONE;
+    bool b = false;
+    double num = 0;
+    string str;
+    vector<value> arr;
+    map<string, value> obj;
+
+    value() {}
+    value(bool v) : t(BOOL), b(v) {}
+    value(const char *v) : t(STRING), str(v) {}
+    value(const string &v) : t(STRING), str(v) {}
+
+    template <typename T, typename = typename enable_if<is_arithmetic<T>::value>::type>
+    value(T v) : t(NUMBER), num(static_cast<double>(v)) {}
+
+    static value array() { value v; v.t = ARRAY; return v; }
+    static value object() { value v; v.t = OBJECT; return v; }
+
+    bool has(const string &key) const {
+        return t == OBJECT && obj.count(key) > 0;
+    }
+
+    value &operator[](const string &key) {
+        if (t == NONE) t = OBJECT;
+        if (t != OBJECT) throw runtime_error("json: not an object");
+        return obj[key];
+    }
+
+    const value &at(const string &key) const {
+        if (!has(key)) throw runtime_error("json: missing key \"" + key + "\"");
+        return obj.at(key);
+    }
+
+    void push_back(const value &v) {
+        if (t == NONE) t = ARRAY;
+        if (t != ARRAY) throw runtime_error("json: not an array");
+        arr.push_back(v);
+    }
+
+    double as_number() const {
+        if (t != NUMBER) throw runtime_error("json: not a number");
+        return num;
+    }
+
+    size_t as_size() const {
+        const double n = as_number();
+        if (n < 0 || n != floor(n)) throw runtime_error("json: not a non-negative integer");
+        return static_cast<size_t>(n);
+    }
+
+    const string &as_string() const {
+        if (t != STRING) throw runtime_error("json: not a string");
+        return str;
+    }
+
+    bool as_bool() const {
+        if (t != BOOL) throw runtime_error("json: not a boolean");
+        return b;
+    }
+
+    // optional object members
+    double get_number(const string &key, double def) const { return has(key) ? at(key).as_number() : def; }
+    size_t get_size(const string &key, size_t def) const { return has(key) ? at(key).as_size() : def; }
+    string get_string(const string &key, const string &def) const { return has(key) ? at(key).as_string() : def; }
+    bool get_bool(const string &key, bool def) const { return has(key) ? at(key).as_bool() : def; }
+
+    void dump(ostream &os) const {
+        switch (t) {
+        case NONE:
+            os << "null";
+            break;
+        case BOOL:
+            os << (b ? "true" : "false");
+            break;
+        case NUMBER:
+            // integers are printed as such, everything else with enough digits to round-trip
+            if (num == floor(num) && fabs(num) < 9007199254740992.0) {
+                os << static_cast<long long>(num);
+            } else {
+                ostringstream ss;
+                ss.precision(17);
+                ss << num;
+                os << ss.str();
+            }
+            break;
+        case STRING:
+            dump_string(os, str);
+            break;
+        case ARRAY:
+            os << "[";
+            for (size_t i = 0; i < arr.size(); i++) {
+                if (i > 0) os << ",";
+                arr[i].dump(os);
+            }
+            os << "]";
+            break;
+        case OBJECT:
+            os << "{";
+            for (auto it = obj.begin(); it != obj.end(); ++it) {
+                if (it != obj.begin()) os << ",";
+                dump_string(os, it->first);
+                os << ":";
+                it->second.dump(os);
+            }
+            os << "}";
+            break;
+        }
+    }
+
+    string dump() const {
+        ostringstream os;
+        dump(os);
+        return os.str();
+    }
+
+private:
+    static void dump_string(ostream &os, const string &s) {
+        static const char *hex = "0123456789abcdef";
+
+        os << '"';
+        for (unsigned char c : s) {
+            switch (c) {
+            case '"': os << "\\\""; break;
+            case '\\': os << "\\\\"; break;
+            case '\n': os << "\\n"; break;
+            case '\r': os << "\\r"; break;
+            case '\t': os << "\\t"; break;
+            default:
+                if (c < 0x20) os << "\\u00" << hex[c >> 4] << hex[c & 0xf];
+                else os << c;
+            }
+        }
+        os << '"';
+    }
+};
+
+namespace detail {
+
+struct parser {
+    const string &s;
+    size_t pos = 0;
+
+    explicit parser(const string &text) : s(text) {}
+
+    [[noreturn]] void fail(const string &what) {
+        throw runtime_error("json: " + what + " at offset " + to_string(pos));
+    }
+
+    void skip_ws() {
+        while (pos < s.size() && (s[pos] == ' ' || s[pos] == '\t' || s[pos] == '\n' || s[pos] == '\r')) pos++;
+    }
+
+    bool consume(const char *lit) {
+        const size_t n = char_traits<char>::length(lit);
+        if (s.compare(pos, n, lit) != 0) return false;
+        pos += n;
+        return true;
+    }
+
+    value parse_value() {
+        skip_ws();
+        if (pos >= s.size()) fail("unexpected end of input");
+
+        const char c = s[pos];
+        if (c == '{') return parse_object();
+        if (c == '[') return parse_array();
+        if (c == '"') return value(parse_string());
+        if (consume("true")) return value(true);
+        if (consume("false")) return value(false);
+        if (consume("null")) return value();
+        return parse_number();
+    }
+
+    value parse_object() {
+        value v = value::object();
+
+        pos++;
+        skip_ws();
+        if (pos < s.size() && s[pos] == '}') { pos++; return v; }
+
+        while (true) {
+            skip_ws();
+            if (pos >= s.size() || s[pos] != '"') fail("expected key");
+            const string key = parse_string();
+
+            skip_ws();
+            if (pos >= s.size() || s[pos] != ':') fail("expected ':'");
+            pos++;
+
+            v.obj[key] = parse_value();
+
+            skip_ws();
+            if (pos < s.size() && s[pos] == ',') { pos++; continue; }
+            if (pos < s.size() && s[pos] == '}') { pos++; return v; }
+            fail("expected ',' or '}'");
+        }
+    }
+
+    value parse_array() {
+        value v = value::array();
+
+        pos++;
+        skip_ws();
+        if (pos < s.size() && s[pos] == ']') { pos++; return v; }
+
+        while (true) {
+            v.arr.push_back(parse_value());
+
+            skip_ws();
+            if (pos < s.size() && s[pos] == ',') { pos++; continue; }
+            if (pos < s.size() && s[pos] == ']') { pos++; return v; }
+            fail("expected ',' or ']'");
+        }
+    }
+
+    string parse_string() {
+        string out;
+
+        pos++;
+        while (pos < s.size() && s[pos] != '"') {
+            char c = s[pos++];
+
+            if (c != '\\') {
+                out += c;
+                continue;
+            }
+
+            if (pos >= s.size()) fail("unterminated escape");
+            c = s[pos++];
+
+            switch (c) {
+            case '"': case '\\': case '/': out += c; break;
+            case 'b': out += '\b'; break;
+            case 'f': out += '\f'; break;
+            case 'n': out += '\n'; break;
+            case 'r': out += '\r'; break;
+            case 't': out += '\t'; break;
+            case 'u': {
+                if (pos + 4 > s.size()) fail("truncated \\u escape");
+                const unsigned cp = stoul(s.substr(pos, 4), nullptr, 16);
+                pos += 4;
+
+                // basic multilingual plane only, encoded as UTF-8
+                if (cp < 0x80) {
+                    out += static_cast<char>(cp);
+                } else if (cp < 0x800) {
+                    out += static_cast<char>(0xc0 | (cp >> 6));
+                    out += static_cast<char>(0x80 | (cp & 0x3f));
+                } else {
+                    out += static_cast<char>(0xe0 | (cp >> 12));
+                    out += static_cast<char>(0x80 | ((cp >> 6) & 0x3f));
+                    out += static_cast<char>(0x80 | (cp & 0x3f));
+                }
+                break;
+            }
+            default:
+                fail("invalid escape");
+            }
+        }
+
+        if (pos >= s.size()) fail("unterminated string");
+        pos++;
+
+        return out;
+    }
+
+    value parse_number() {
+        const char *begin = s.c_str() + pos;
+        char *end;
+        const double n = strtod(begin, &end);
+
+        if (end == begin) fail("unexpected character");
+        pos += end - begin;
+
+        return value(n);
+    }
+};
+
+}
+
+inline value parse(const string &text) {
+    detail::parser p(text);
+    value v = p.parse_value();
+
+    p.skip_ws();
+    if (p.pos != text.size()) p.fail("trailing characters");
+
+    return v;
+}
+
+}
+}
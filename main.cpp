@@ -5,6 +5,7 @@
 
 #include <systemc>
 
+#include "batch.h"
 #include "row_stationary.h"
 #include "tests.h"
 
@@ -23,7 +24,50 @@ typedef uint8_t psum_t;
 typedef router<weight_t> wrouter;
 typedef router_cluster<weight_t, iact_t, psum_t, 3, 4> cluster;
 
-int sc_main (int, char *[]) {
+static void batch_usage(const char *argv0) {
+    cerr << "usage: " << argv0 << " --batch JOBS [--out RESULTS] [--cache DIR] [--workers N]" << endl;
+}
+
+// convsim --batch JOBS [--out RESULTS] [--cache DIR] [--workers N]
+static int batch_main(int argc, char *argv[]) {
+    if (argc < 3) {
+        batch_usage(argv[0]);
+        return 2;
+    }
+
+    batch::options opts;
+    opts.jobs_path = argv[2];
+    opts.out_path = "results.jsonl";
+
+    for (int i = 3; i < argc; i++) {
+        const string arg = argv[i];
+
+        if (i + 1 >= argc) {
+            batch_usage(argv[0]);
+            return 2;
+        }
+
+        if (arg == "--out") opts.out_path = argv[++i];
+        else if (arg == "--cache") opts.cache_dir = argv[++i];
+        else if (arg == "--workers") opts.workers = stoul(argv[++i]);
+        else {
+            batch_usage(argv[0]);
+            return 2;
+        }
+    }
+
+    const size_t failed = batch::run(opts);
+
+    cerr << "Batch done, " << failed << " failed jobs, results in " << opts.out_path << endl;
+
+    return failed == 0 ? 0 : 1;
+}
+
+int sc_main (int argc, char *argv[]) {
+    if (argc > 1 && string(argv[1]) == "--batch") {
+        return batch_main(argc, argv);
+    }
+
     const double clk_period = 10;
     sc_clock clk("clk", clk_period, SC_NS);
 
@@ -33,11 +77,82 @@ int sc_main (int, char *[]) {
     pe_cluster_tb pe_tb("pe_tb", false, false);
     pe_tb.clk(clk);
 
-    pe_cluster_conv1 pe_conv1("pe_conv1", false, true);
+    pe_cluster_conv1 pe_conv1("pe_conv1", false, false);
     pe_conv1.clk(clk);
 
+    // see the fuzz tool for larger arrays, more trials and other seeds
+    pe_cluster_fuzz<4, 4> pe_fuzz("pe_fuzz", false, false);
+    pe_fuzz.clk(clk);
+
+    // NoC and global buffer in a slower clock domain than the array
+    sc_clock noc_clk("noc_clk", 13, SC_NS);
+    reference::conv_shape cd_shape;
+    cd_shape.ifmap_h = 6;
+    cd_shape.ifmap_w = 16;
+    cd_shape.kernel_h = 3;
+    cd_shape.kernel_w = 3;
+
+    clock_domain_conv<uint8_t, uint8_t, uint32_t, 4, 4> cd_conv("cd_conv", false, false, cd_shape, 1);
+    cd_conv.clk(clk);
+    cd_conv.noc_clk(noc_clk);
+
+    // depthwise, pointwise and fully-connected mapping modes
+    typedef pe_cluster_layer<uint8_t, uint8_t, uint32_t, 4, 4> pe_cluster_layer_4x4;
+
+    reference::conv_shape dw_shape;
+    dw_shape.channels = 5;
+    dw_shape.ifmap_h = 4;
+    dw_shape.ifmap_w = 9;
+    dw_shape.kernel_h = 3;
+    dw_shape.kernel_w = 3;
+
+    pe_cluster_layer_4x4 dw_layer("dw_layer", false, false, DEPTHWISE, dw_shape, 1);
+    dw_layer.clk(clk);
+
+    reference::conv_shape pw_shape;
+    pw_shape.batch = 2;
+    pw_shape.channels = 6;
+    pw_shape.filters = 6;
+    pw_shape.ifmap_h = 3;
+    pw_shape.ifmap_w = 5;
+
+    pe_cluster_layer_4x4 pw_layer("pw_layer", false, false, POINTWISE, pw_shape, 1);
+    pw_layer.clk(clk);
+
+    reference::conv_shape fc_shape;
+    fc_shape.batch = 7;
+    fc_shape.channels = 9;
+    fc_shape.filters = 3;
+
+    pe_cluster_layer_4x4 fc_layer("fc_layer", false, false, FULLY_CONNECTED, fc_shape, 1);
+    fc_layer.clk(clk);
+
+    // input channels over a chain of clusters, all simulated here (see the partitioned tool for one per process)
+    typedef cluster_chain_conv<uint8_t, uint8_t, uint32_t, 4, 4> cluster_chain_conv_4x4;
+
+    reference::conv_shape chain_shape;
+    chain_shape.channels = 3;
+    chain_shape.filters = 2;
+    chain_shape.ifmap_h = 6;
+    chain_shape.ifmap_w = 10;
+    // fewer kernel rows than PE rows: chained psums pass through the idle bottom row of each cluster
+    chain_shape.kernel_h = 3;
+    chain_shape.kernel_w = 3;
+
+    partition_set chain_parts(chain_shape.channels);
+    cluster_chain_conv_4x4::chain_links chain_links(chain_parts, 2);
+
+    cluster_chain_conv_4x4 chain_conv("chain_conv", false, true, chain_shape, 1, chain_links);
+    chain_conv.clk(clk);
+
     pe_tb.start = &r_tb.end;
     pe_conv1.start = &pe_tb.end;
+    pe_fuzz.start = &pe_conv1.end;
+    cd_conv.start = &pe_fuzz.end;
+    dw_layer.start = &cd_conv.end;
+    pw_layer.start = &dw_layer.end;
+    fc_layer.start = &pw_layer.end;
+    chain_conv.start = &fc_layer.end;
 
     sc_start();
 
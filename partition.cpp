@@ -0,0 +1,65 @@
+#include "partition.h"
+
+#include <sched.h>
+#include <sys/mman.h>
+
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+
+using namespace convsim;
+
+partition_set::partition_set(size_t partitions, size_t arena_bytes) : n(partitions), arena_size(arena_bytes) {
+    if (partitions == 0) throw runtime_error("a partition set needs at least one partition");
+
+    // shared with the children forked later, pages are only backed once touched
+    void *p = mmap(nullptr, arena_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+
+    if (p == MAP_FAILED) {
+        throw runtime_error(string("mmap failed: ") + strerror(errno));
+    }
+
+    arena = static_cast<char *>(p);
+
+    static_assert(atomic<uint64_t>::is_always_lock_free, "progress counters must be usable across processes");
+    completed = static_cast<atomic<uint64_t> *>(alloc(n * sizeof(atomic<uint64_t>)));
+    for (size_t i = 0; i < n; i++) new (&completed[i]) atomic<uint64_t>(0);
+}
+
+partition_set::~partition_set() {
+    munmap(arena, arena_size);
+}
+
+void partition_set::select(size_t p) {
+    if (p >= n) throw runtime_error("selected partition " + to_string(p) + " out of " + to_string(n));
+
+    selected = p;
+}
+
+void partition_set::publish(size_t p, uint64_t cycles) {
+    // only the partition itself writes its counter
+    if (completed[p].load(memory_order_relaxed) < cycles) completed[p].store(cycles, memory_order_release);
+}
+
+void partition_set::finish(size_t p) {
+    completed[p].store(UINT64_MAX, memory_order_release);
+}
+
+void partition_set::wait_for(size_t p, uint64_t cycles) const {
+    // peers are usually a few cycles away: spin briefly, then leave the core to them
+    for (size_t spins = 0; completed[p].load(memory_order_acquire) < cycles; spins++) {
+        if (spins >= 64) sched_yield();
+    }
+}
+
+void *partition_set::alloc(size_t bytes) {
+    const size_t align = alignof(max_align_t);
+    const size_t start = (used + align - 1) / align * align;
+
+    if (start + bytes > arena_size) throw runtime_error("partition shared memory exhausted");
+
+    used = start + bytes;
+
+    // fresh anonymous pages are zeroed
+    return arena + start;
+}
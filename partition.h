@@ -0,0 +1,290 @@
+#pragma once
+
+#include <systemc>
+
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <new>
+#include <string>
+#include <type_traits>
+
+#include "common.h"
+
+namespace convsim {
+
+using namespace std;
+using namespace sc_core;
+
+// Partitioned simulation: the design is split into partitions that exchange data only through partition_links,
+// so that each partition can be simulated by its own process (the SystemC kernel is single-threaded)
+// - links have a latency of at least one cycle, which is the lookahead of a conservative synchronization: every
+//   partition publishes in shared memory the cycles it has completed, and a link end at cycle t only needs its
+//   peer to have completed cycle t - latency, so no partition runs ahead of what it may still receive
+// - the timing of a link doesn't depend on where its two ends are simulated, so a partitioned run is cycle-exact
+//   with the monolithic one (all the partitions in the same process)
+class partition_set {
+public:
+    // until one is selected, this process simulates all the partitions
+    static constexpr size_t all = SIZE_MAX;
+
+    // maps the shared memory: to be created before forking the partitions
+    explicit partition_set(size_t partitions, size_t arena_bytes = size_t(64) << 20);
+    ~partition_set();
+
+    partition_set(const partition_set &) = delete;
+    partition_set &operator=(const partition_set &) = delete;
+
+    size_t size() const {
+        return n;
+    }
+
+    // the partition simulated by this process
+    void select(size_t p);
+
+    bool local(size_t p) const {
+        return selected == all || selected == p;
+    }
+
+    // cycles completed by a partition, published by the partition itself
+    void publish(size_t p, uint64_t cycles);
+    // the partition won't send anything anymore, so its peers don't wait for it
+    void finish(size_t p);
+    // waits until a remote partition has completed the given cycles
+    void wait_for(size_t p, uint64_t cycles) const;
+
+    // zero-initialized shared memory, as long as the partition set lives
+    void *alloc(size_t bytes);
+
+private:
+    size_t n;
+    size_t selected = all;
+
+    char *arena;
+    size_t arena_size;
+    size_t used = 0;
+
+    atomic<uint64_t> *completed;
+};
+
+// shared state of a link from partition from to partition to: cycle-stamped element and credit rings in shared
+// memory, which never overflow as the sender needs a credit for each element
+template <typename T>
+struct partition_link {
+    static_assert(is_trivially_copyable<T>::value, "link elements are copied through shared memory");
+
+    struct entry {
+        uint64_t stamp;
+        T value;
+    };
+
+    partition_link(partition_set &parts, size_t from, size_t to, size_t latency, size_t depth)
+        : parts(parts), from(from), to(to), latency(latency), depth(depth) {
+        if (from >= parts.size() || to >= parts.size()) throw runtime_error("partition_link to unknown partition");
+        if (latency == 0) throw runtime_error("partition_link latency must be at least one cycle");
+        if (depth == 0) throw runtime_error("partition_link depth must be positive");
+
+        data = static_cast<entry *>(parts.alloc(depth * sizeof(entry)));
+        credit_stamp = static_cast<uint64_t *>(parts.alloc(depth * sizeof(uint64_t)));
+        sent = new (parts.alloc(sizeof(atomic<uint64_t>))) atomic<uint64_t>(0);
+        freed = new (parts.alloc(sizeof(atomic<uint64_t>))) atomic<uint64_t>(0);
+    }
+
+    partition_set &parts;
+    const size_t from;
+    const size_t to;
+    const size_t latency;
+    const size_t depth;
+
+    // written by the sender
+    entry *data;
+    atomic<uint64_t> *sent;
+    // written by the receiver, one per element read
+    uint64_t *credit_stamp;
+    atomic<uint64_t> *freed;
+};
+
+// clock cycle of the current simulation time
+inline uint64_t current_cycle(const sc_in<bool> &clk) {
+    return llround(sc_time_stamp() / clock_period(clk));
+}
+
+// sending end of a partition_link: elements written at cycle t can be read from cycle t + latency, and a slot
+// freed by the receiver at cycle t can be written again from cycle t + latency
+template <typename T>
+class link_tx : public sc_module, public sc_fifo_out_if<T> {
+public:
+    // clock signal
+    sc_in<bool> clk;
+
+    SC_HAS_PROCESS(link_tx);
+
+    link_tx(sc_module_name name, partition_link<T> &link)
+        : sc_module(name), clk("clk"), link(link), credits(link.depth) {
+        if (!link.parts.local(link.from)) {
+            throw runtime_error(string(this->name()) + " link sender outside of its partition");
+        }
+
+        SC_METHOD(sync);
+        sensitive << clk.pos();
+    }
+
+    // blocking interface
+    virtual void write(const T &val) override {
+        while (credits == 0) sc_core::wait(credit_event);
+
+        credits--;
+
+        const uint64_t n = link.sent->load(memory_order_relaxed);
+        link.data[n % link.depth] = {current_cycle(clk), val};
+        link.sent->store(n + 1, memory_order_release);
+
+        written_event.notify(SC_ZERO_TIME);
+    }
+
+    // non-blocking interface
+    virtual bool nb_write(const T &val) override {
+        if (credits == 0) return false;
+        write(val);
+        return true;
+    }
+
+    virtual int num_free() const override {
+        return credits;
+    }
+
+    virtual const sc_event &data_read_event() const override {
+        return credit_event;
+    }
+
+    virtual const sc_event &default_event() const override {
+        return credit_event;
+    }
+
+    virtual const char *kind() const override {
+        return "link_tx";
+    }
+
+    // elements sent so far, and their event
+    uint64_t sent() const {
+        return link.sent->load(memory_order_relaxed);
+    }
+
+    const sc_event &data_written_event() const {
+        return written_event;
+    }
+
+private:
+    // takes back the credits freed up to latency cycles ago
+    void sync() {
+        const uint64_t t = current_cycle(clk);
+
+        link.parts.publish(link.from, t);
+        if (t < link.latency) return;
+
+        if (!link.parts.local(link.to)) link.parts.wait_for(link.to, t - link.latency + 1);
+
+        const uint64_t freed = link.freed->load(memory_order_acquire);
+        const size_t before = credits;
+
+        while (credit_head < freed && link.credit_stamp[credit_head % link.depth] <= t - link.latency) {
+            credit_head++;
+            credits++;
+        }
+
+        if (credits != before) credit_event.notify(SC_ZERO_TIME);
+    }
+
+    partition_link<T> &link;
+    size_t credits;
+    uint64_t credit_head = 0;
+
+    sc_event credit_event;
+    sc_event written_event;
+};
+
+// receiving end of a partition_link
+template <typename T>
+class link_rx : public sc_module, public sc_fifo_in_if<T> {
+public:
+    // clock signal
+    sc_in<bool> clk;
+
+    SC_HAS_PROCESS(link_rx);
+
+    link_rx(sc_module_name name, partition_link<T> &link) : sc_module(name), clk("clk"), link(link) {
+        if (!link.parts.local(link.to)) {
+            throw runtime_error(string(this->name()) + " link receiver outside of its partition");
+        }
+
+        SC_METHOD(sync);
+        sensitive << clk.pos();
+    }
+
+    // blocking interface
+    virtual void read(T &val) override {
+        while (head == visible) sc_core::wait(written_event);
+
+        val = link.data[head % link.depth].value;
+        head++;
+
+        const uint64_t n = link.freed->load(memory_order_relaxed);
+        link.credit_stamp[n % link.depth] = current_cycle(clk);
+        link.freed->store(n + 1, memory_order_release);
+    }
+
+    virtual T read() override {
+        T val;
+        read(val);
+        return val;
+    }
+
+    // non-blocking interface
+    virtual bool nb_read(T &val) override {
+        if (head == visible) return false;
+        read(val);
+        return true;
+    }
+
+    virtual int num_available() const override {
+        return visible - head;
+    }
+
+    virtual const sc_event &data_written_event() const override {
+        return written_event;
+    }
+
+    virtual const sc_event &default_event() const override {
+        return written_event;
+    }
+
+    virtual const char *kind() const override {
+        return "link_rx";
+    }
+
+private:
+    // makes the elements sent up to latency cycles ago readable
+    void sync() {
+        const uint64_t t = current_cycle(clk);
+
+        link.parts.publish(link.to, t);
+        if (t < link.latency) return;
+
+        if (!link.parts.local(link.from)) link.parts.wait_for(link.from, t - link.latency + 1);
+
+        const uint64_t sent = link.sent->load(memory_order_acquire);
+        const uint64_t before = visible;
+
+        while (visible < sent && link.data[visible % link.depth].stamp <= t - link.latency) visible++;
+
+        if (visible != before) written_event.notify(SC_ZERO_TIME);
+    }
+
+    partition_link<T> &link;
+    uint64_t head = 0;
+    uint64_t visible = 0;
+
+    sc_event written_event;
+};
+
+}
@@ -0,0 +1,162 @@
+#pragma once
+
+#include <systemc>
+
+#include <algorithm>
+#include <deque>
+#include <string>
+
+#include "common.h"
+
+namespace convsim {
+
+using namespace std;
+using namespace sc_core;
+
+// Global buffer slice holding the partial sums of one PE column across passes (e.g. one pass per input channel):
+// psums of every pass but the last one are spilled into the buffer and reinjected, in order, into the psum input of
+// the column on the next pass, while psums of the last pass are final and leave through result_out
+// the buffer has a single port: every spilled or reinjected psum takes a cycle of it, so spills and reinjections
+// take turns, and once capacity psums are held the column stalls until some are reinjected
+template <typename PSum_t>
+SC_MODULE(psum_spill_buffer) {
+    // default number of psums the buffer can hold
+    static constexpr size_t default_capacity = 256;
+
+    // clock signal
+    sc_in<bool> clk;
+    // psums leaving the array
+    sc_fifo_in<PSum_t> spill_in;
+    // psums going back to the array
+    sc_fifo_out<PSum_t> reinject_out;
+    // final psums
+    sc_fifo_out<PSum_t> result_out;
+
+    SC_HAS_PROCESS(psum_spill_buffer);
+
+    psum_spill_buffer(sc_module_name name, size_t capacity = default_capacity)
+        : sc_module(name), clk("clk"), spill_in("spill_in"), reinject_out("reinject_out"), result_out("result_out"),
+          capacity(capacity) {
+        if (capacity == 0) {
+            throw runtime_error(string(this->name()) + " psum spill buffer capacity must be positive");
+        }
+
+        SC_THREAD(spill_thread);
+        sensitive << clk.pos();
+
+        SC_THREAD(reinject_thread);
+        sensitive << clk.pos();
+    }
+
+    // psums_per_pass psums leave the column on each of the passes
+    void set_config(size_t new_psums_per_pass, size_t new_passes) {
+        if (new_psums_per_pass == 0 || new_passes == 0) {
+            throw runtime_error(string(name()) + " invalid psum spill buffer configuration");
+        }
+
+        // the first psum of a pass needs the whole previous pass to have left the column
+        if (new_passes > 1 && new_psums_per_pass > capacity) {
+            throw runtime_error(string(name()) + " a pass of " + to_string(new_psums_per_pass) +
+                                " psums doesn't fit the " + to_string(capacity) + " psums spill buffer");
+        }
+
+        psums_per_pass = new_psums_per_pass;
+        passes = new_passes;
+    }
+
+    // traffic counters
+    uint64_t spilled() const {
+        return n_spilled;
+    }
+
+    uint64_t reinjected() const {
+        return n_reinjected;
+    }
+
+    // largest number of psums held at once (queued on the reinjection link included), i.e. the buffer capacity
+    // needed
+    size_t peak_occupancy() const {
+        return peak;
+    }
+
+    // time the column waited for room in the buffer
+    const sc_time &full_stall() const {
+        return full_wait;
+    }
+
+private:
+    void spill_thread() {
+        while (true) {
+            for (size_t pass = 0; pass < passes; pass++) {
+                for (size_t i = 0; i < psums_per_pass; i++) {
+                    if (pass == passes - 1) {
+                        result_out.write(spill_in.read());
+                        continue;
+                    }
+
+                    // backpressure: the psum stays in the column until there is room for it
+                    const sc_time wait_start = sc_time_stamp();
+                    while (staged.size() >= capacity) wait(unstaged_event);
+                    full_wait += sc_time_stamp() - wait_start;
+
+                    const PSum_t psum = spill_in.read();
+
+                    take_port();
+                    wait(1);
+                    staged.push_back(psum);
+                    n_spilled++;
+                    peak = max(peak, occupancy());
+                    staged_event.notify(SC_ZERO_TIME);
+                }
+            }
+        }
+    }
+
+    // claims the port for the current cycle, or for the next free one
+    void take_port() {
+        while (sc_time_stamp() < port_free) wait();
+
+        port_free = sc_time_stamp() + clock_period(clk);
+    }
+
+    size_t occupancy() {
+        return staged.size() + link_depth - reinject_out->num_free();
+    }
+
+    void reinject_thread() {
+        // the link is still empty
+        link_depth = reinject_out->num_free();
+
+        while (true) {
+            while (staged.empty()) wait(staged_event);
+
+            take_port();
+
+            const PSum_t psum = staged.front();
+            staged.pop_front();
+            unstaged_event.notify(SC_ZERO_TIME);
+
+            wait(1);
+            reinject_out.write(psum);
+            n_reinjected++;
+        }
+    }
+
+    size_t psums_per_pass = 1;
+    size_t passes = 1;
+
+    const size_t capacity;
+    deque<PSum_t> staged;
+    size_t link_depth = 0;
+    sc_event staged_event;
+    sc_event unstaged_event;
+    // first time the port is free again
+    sc_time port_free;
+    sc_time full_wait;
+
+    uint64_t n_spilled = 0;
+    uint64_t n_reinjected = 0;
+    size_t peak = 0;
+};
+
+}
@@ -0,0 +1,293 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <functional>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace convsim {
+namespace reference {
+
+using namespace std;
+
+// functional (untimed) convolution engine, used as golden model for the simulator
+// tensors are dense vectors: ifmap is NCHW, weights are MCRS, ofmap is NMEF
+struct conv_shape {
+    // N
+    size_t batch = 1;
+    // C
+    size_t channels = 1;
+    // M
+    size_t filters = 1;
+    // H x W
+    size_t ifmap_h = 1;
+    size_t ifmap_w = 1;
+    // R x S
+    size_t kernel_h = 1;
+    size_t kernel_w = 1;
+    size_t stride = 1;
+
+    bool valid() const {
+        return batch > 0 && channels > 0 && filters > 0 && stride > 0 &&
+               kernel_h > 0 && kernel_w > 0 && kernel_h <= ifmap_h && kernel_w <= ifmap_w;
+    }
+
+    // E x F
+    size_t ofmap_h() const { return (ifmap_h - kernel_h) / stride + 1; }
+    size_t ofmap_w() const { return (ifmap_w - kernel_w) / stride + 1; }
+
+    size_t ifmap_size() const { return batch * channels * ifmap_h * ifmap_w; }
+    size_t weight_size() const { return filters * channels * kernel_h * kernel_w; }
+    size_t ofmap_size() const { return batch * filters * ofmap_h() * ofmap_w(); }
+    size_t macs() const { return ofmap_size() * channels * kernel_h * kernel_w; }
+};
+
+namespace detail {
+
+// vector lanes reproduce the PE arithmetic only if PSum_t wraps around and the PE product is at least as
+// wide as PSum_t (processing_element::stage3 truncates every partial sum to PSum_t)
+template <typename W_t, typename IAct_t, typename PSum_t>
+constexpr bool exact_lanes = is_integral<PSum_t>::value && is_unsigned<PSum_t>::value &&
+                             sizeof(PSum_t) <= sizeof(decltype(declval<IAct_t>() * declval<W_t>()));
+
+constexpr size_t vector_bytes = 32;
+
+// acc[i] = acc[i] + x[i * stride] * w for i in [0, n), with the same overflow semantics as the PE
+template <typename W_t, typename IAct_t, typename PSum_t>
+inline void mac_row(PSum_t *__restrict acc, const IAct_t *__restrict x, size_t stride, W_t w, size_t n) {
+    size_t i = 0;
+
+    if constexpr (exact_lanes<W_t, IAct_t, PSum_t>) {
+        constexpr size_t lanes = vector_bytes / sizeof(PSum_t);
+        typedef PSum_t lanes_t __attribute__((vector_size(vector_bytes)));
+        typedef IAct_t in_lanes_t __attribute__((vector_size(lanes * sizeof(IAct_t))));
+        const PSum_t wl = static_cast<PSum_t>(w);
+
+        for (; i + lanes <= n; i += lanes) {
+            lanes_t a, v;
+
+            if (stride == 1) {
+                in_lanes_t in;
+                memcpy(&in, x + i, sizeof(in));
+                v = __builtin_convertvector(in, lanes_t);
+            } else {
+                for (size_t l = 0; l < lanes; l++) v[l] = static_cast<PSum_t>(x[(i + l) * stride]);
+            }
+
+            memcpy(&a, acc + i, sizeof(a));
+            a += v * wl;
+            memcpy(acc + i, &a, sizeof(a));
+        }
+    }
+
+    for (; i < n; i++) {
+        acc[i] = acc[i] + x[i * stride] * w;
+    }
+}
+
+// runs body(0) ... body(n - 1) over a pool of threads (0 means one per hardware thread)
+inline void parallel_for(size_t n, size_t threads, const function<void(size_t)> &body) {
+    if (threads == 0) threads = max<size_t>(1, thread::hardware_concurrency());
+    threads = min(threads, n);
+
+    if (threads <= 1) {
+        for (size_t i = 0; i < n; i++) body(i);
+        return;
+    }
+
+    atomic<size_t> next(0);
+    auto worker = [&]() {
+        for (size_t i = next++; i < n; i = next++) body(i);
+    };
+
+    vector<thread> pool;
+    for (size_t t = 1; t < threads; t++) pool.emplace_back(worker);
+    worker();
+    for (auto &t : pool) t.join();
+}
+
+template <typename W_t, typename IAct_t>
+void check(const conv_shape &shape, const vector<IAct_t> &ifmap, const vector<W_t> &weights) {
+    if (!shape.valid()) {
+        throw runtime_error("reference: invalid convolution shape");
+    }
+
+    if (ifmap.size() != shape.ifmap_size() || weights.size() != shape.weight_size()) {
+        throw runtime_error("reference: tensor sizes don't match the convolution shape");
+    }
+}
+
+}
+
+// direct convolution: one work item per output row
+template <typename W_t, typename IAct_t, typename PSum_t>
+vector<PSum_t> conv2d_direct(const conv_shape &shape, const vector<IAct_t> &ifmap, const vector<W_t> &weights,
+                             size_t threads = 0) {
+    detail::check(shape, ifmap, weights);
+
+    const size_t C = shape.channels, M = shape.filters;
+    const size_t H = shape.ifmap_h, W = shape.ifmap_w;
+    const size_t R = shape.kernel_h, S = shape.kernel_w;
+    const size_t E = shape.ofmap_h(), F = shape.ofmap_w();
+    const size_t U = shape.stride;
+
+    vector<PSum_t> ofmap(shape.ofmap_size(), 0);
+
+    detail::parallel_for(shape.batch * M * E, threads, [&](size_t item) {
+        const size_t e = item % E;
+        const size_t m = (item / E) % M;
+        const size_t n = item / (E * M);
+        PSum_t *acc = &ofmap[item * F];
+
+        for (size_t c = 0; c < C; c++) {
+            for (size_t r = 0; r < R; r++) {
+                const IAct_t *row = &ifmap[((n * C + c) * H + e * U + r) * W];
+
+                for (size_t s = 0; s < S; s++) {
+                    detail::mac_row(acc, row + s, U, weights[((m * C + c) * R + r) * S + s], F);
+                }
+            }
+        }
+    });
+
+    return ofmap;
+}
+
+// depthwise convolution: each input channel is convolved with its own R x S kernel (shape.filters is ignored),
+// weights are CRS and the ofmap is NCEF
+template <typename W_t, typename IAct_t, typename PSum_t>
+vector<PSum_t> conv2d_depthwise(const conv_shape &shape, const vector<IAct_t> &ifmap, const vector<W_t> &weights,
+                                size_t threads = 0) {
+    conv_shape channel = shape;
+    channel.channels = 1;
+    channel.filters = 1;
+
+    if (!shape.valid() || ifmap.size() != shape.ifmap_size() ||
+        weights.size() != shape.channels * channel.weight_size()) {
+        throw runtime_error("reference: tensors don't match the depthwise convolution shape");
+    }
+
+    const size_t C = shape.channels;
+    const size_t H = shape.ifmap_h, W = shape.ifmap_w;
+    const size_t R = shape.kernel_h, S = shape.kernel_w;
+    const size_t E = shape.ofmap_h(), F = shape.ofmap_w();
+    const size_t U = shape.stride;
+
+    vector<PSum_t> ofmap(shape.batch * C * E * F, 0);
+
+    detail::parallel_for(shape.batch * C * E, threads, [&](size_t item) {
+        const size_t e = item % E;
+        const size_t c = (item / E) % C;
+        const size_t n = item / (E * C);
+        PSum_t *acc = &ofmap[item * F];
+
+        for (size_t r = 0; r < R; r++) {
+            const IAct_t *row = &ifmap[((n * C + c) * H + e * U + r) * W];
+
+            for (size_t s = 0; s < S; s++) {
+                detail::mac_row(acc, row + s, U, weights[(c * R + r) * S + s], F);
+            }
+        }
+    });
+
+    return ofmap;
+}
+
+// im2col convolution: the ifmap of each image is unrolled into a (C*R*S) x (E*F) matrix, then multiplied by the
+// M x (C*R*S) weight matrix
+template <typename W_t, typename IAct_t, typename PSum_t>
+vector<PSum_t> conv2d_im2col(const conv_shape &shape, const vector<IAct_t> &ifmap, const vector<W_t> &weights,
+                             size_t threads = 0) {
+    detail::check(shape, ifmap, weights);
+
+    const size_t C = shape.channels, M = shape.filters;
+    const size_t H = shape.ifmap_h, W = shape.ifmap_w;
+    const size_t R = shape.kernel_h, S = shape.kernel_w;
+    const size_t E = shape.ofmap_h(), F = shape.ofmap_w();
+    const size_t U = shape.stride;
+    const size_t K = C * R * S;
+    const size_t P = E * F;
+
+    vector<PSum_t> ofmap(shape.ofmap_size(), 0);
+    vector<IAct_t> cols(K * P);
+
+    for (size_t n = 0; n < shape.batch; n++) {
+        // unroll: one matrix row per (c, r, s)
+        detail::parallel_for(K, threads, [&](size_t k) {
+            const size_t s = k % S;
+            const size_t r = (k / S) % R;
+            const size_t c = k / (S * R);
+
+            for (size_t e = 0; e < E; e++) {
+                const IAct_t *row = &ifmap[((n * C + c) * H + e * U + r) * W + s];
+
+                for (size_t f = 0; f < F; f++) {
+                    cols[k * P + e * F + f] = row[f * U];
+                }
+            }
+        });
+
+        // multiply: one output plane per work item
+        detail::parallel_for(M, threads, [&](size_t m) {
+            PSum_t *acc = &ofmap[(n * M + m) * P];
+
+            for (size_t k = 0; k < K; k++) {
+                detail::mac_row(acc, &cols[k * P], 1, weights[m * K + k], P);
+            }
+        });
+    }
+
+    return ofmap;
+}
+
+// scalar oracle: the convolution as plain nested loops, one multiply-accumulate at a time with no vector lanes and
+// no threads, to check the fast variants against; with depthwise set it computes conv2d_depthwise instead
+template <typename W_t, typename IAct_t, typename PSum_t>
+vector<PSum_t> conv2d_scalar(const conv_shape &shape, const vector<IAct_t> &ifmap, const vector<W_t> &weights,
+                             bool depthwise = false) {
+    const size_t C = shape.channels, M = depthwise ? shape.channels : shape.filters;
+    const size_t H = shape.ifmap_h, W = shape.ifmap_w;
+    const size_t R = shape.kernel_h, S = shape.kernel_w;
+    const size_t E = shape.ofmap_h(), F = shape.ofmap_w();
+    const size_t U = shape.stride;
+
+    if (!shape.valid() || ifmap.size() != shape.ifmap_size() || weights.size() != (depthwise ? 1 : M) * C * R * S) {
+        throw runtime_error("reference: tensors don't match the convolution shape");
+    }
+
+    vector<PSum_t> ofmap(shape.batch * M * E * F, 0);
+
+    for (size_t n = 0; n < shape.batch; n++) {
+        for (size_t m = 0; m < M; m++) {
+            for (size_t e = 0; e < E; e++) {
+                for (size_t f = 0; f < F; f++) {
+                    PSum_t acc = 0;
+
+                    for (size_t c = depthwise ? m : 0; c < (depthwise ? m + 1 : C); c++) {
+                        const size_t k = depthwise ? c : m * C + c;
+
+                        for (size_t r = 0; r < R; r++) {
+                            for (size_t s = 0; s < S; s++) {
+                                acc = acc + ifmap[((n * C + c) * H + e * U + r) * W + f * U + s] *
+                                            weights[(k * R + r) * S + s];
+                            }
+                        }
+                    }
+
+                    ofmap[((n * M + m) * E + e) * F + f] = acc;
+                }
+            }
+        }
+    }
+
+    return ofmap;
+}
+
+}
+}
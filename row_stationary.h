@@ -2,11 +2,14 @@
 
 #include <systemc>
 
+#include <algorithm>
 #include <memory>
 #include <functional>
 #include <list>
+#include <vector>
 
 #include "common.h"
+#include "spsc_fifo.h"
 #include "static_router.h"
 
 namespace convsim {
@@ -53,13 +56,54 @@ SC_MODULE(router_cluster) {
 
 template <typename W_t, typename IAct_t, typename PSum_t>
 SC_MODULE(processing_element) {
+    // largest depth allowed for the internal pipeline fifos, their inline storage
+    static constexpr size_t max_fifo_depth = 64;
+
+    // depths of the internal pipeline fifos, fixed at construction
+    struct fifo_depths {
+        size_t fifo_1to2 = 1;
+        size_t fifo_2to3_act = 1;
+        size_t fifo_2to3_w = 1;
+        // psum forwarding path, only used with psum_forward > 0
+        size_t fifo_psum = 4;
+    };
+
     struct config {
         size_t kernel_w;
         size_t kernel_h;
         bool psum_acc_in;
+        // ifmap row length: the sliding window restarts every ifmap_w iacts (0 means a single endless row)
+        size_t ifmap_w = 0;
+        // rows convolved with the same weight row (one per image) before the next weight row is loaded
+        size_t batch = 1;
+        // consecutive weight rows accumulated into the same psums (e.g. one per input channel): psums of the
+        // previous pass come back through psum_in, so only the bottom row of the mapping sets psum_acc_spill
+        size_t passes = 1;
+        bool psum_acc_spill = false;
+        // idle PE below the rows of the mapping: psum_in is forwarded to psum_out, one psum per cycle, so that
+        // spilled or chained psums reach the bottom row of the mapping
+        bool psum_bypass = false;
+        // after the first weight row, the next one is loaded into a shadow bank while the current one is in use,
+        // and swapped in at the first window of the row (instead of being loaded lazily during that window); an
+        // endless row never changes weight rows, so it needs ifmap_w > 0
+        bool double_buffer_weights = false;
+        // weight rows the PE loads in all (e.g. filters * passes), so that the shadow bank isn't armed again after
+        // the last one (0 means no limit)
+        size_t weight_rows = 0;
+        // finished psums of other groups stacked below (see pe_cluster::config::stacked_groups) that come through
+        // psum_in after each psum of this PE's own group: they are forwarded to psum_out behind this PE's psum by
+        // psum_demux and psum_mux, one per cycle, without taking stage3 cycles
+        size_t psum_forward = 0;
 
         bool valid() {
-            return kernel_w > 0 && kernel_h > 0;
+            return kernel_w > 0 && kernel_h > 0 && (ifmap_w == 0 || ifmap_w >= kernel_w) && batch > 0 &&
+                   passes > 0 && (passes == 1 || ifmap_w > 0) && (!double_buffer_weights || ifmap_w > 0) &&
+                   (psum_forward == 0 || passes == 1);
+        }
+
+        // windows (and psums) per ifmap row
+        size_t ofmap_w() const {
+            return ifmap_w - kernel_w + 1;
         }
     };
 
@@ -79,36 +123,118 @@ private:
     // internal structure
     config cfg;
     // pipe stage1 to stage2 fifo
-    sc_fifo<IAct_t> fifo_1to2;
+    spsc_fifo<IAct_t, max_fifo_depth> fifo_1to2;
     // sliding window - max KW-1 elements
     list<IAct_t> iact_win;
     // weight storage
     vector<W_t> weight_row;
+    // shadow weight bank, filled by weight_loader when double buffering once the first row is active
+    vector<W_t> shadow_row;
+    bool shadow_armed = false;
+    bool shadow_full = false;
+    // weight rows loaded so far, lazily or into the shadow bank
+    size_t rows_loaded = 0;
+    sc_event shadow_loaded;
+    sc_event shadow_free;
     // pipe stage2 to stage3 fifo
-    sc_fifo<IAct_t> fifo_2to3_act;
-    sc_fifo<W_t> fifo_2to3_w;
+    spsc_fifo<IAct_t, max_fifo_depth> fifo_2to3_act;
+    spsc_fifo<W_t, max_fifo_depth> fifo_2to3_w;
+    // psum forwarding path: psums of the own group to accumulate (from psum_demux to stage3), psums of the own
+    // group produced (from stage3 to psum_mux) and psums of the groups below (from psum_demux to psum_mux)
+    spsc_fifo<PSum_t, max_fifo_depth> fifo_psum_acc;
+    spsc_fifo<PSum_t, max_fifo_depth> fifo_psum_own;
+    spsc_fifo<PSum_t, max_fifo_depth> fifo_psum_fwd;
+    // set by stage3 at its first window when forwarding, starts psum_demux and psum_mux
+    bool forwarding = false;
+    sc_event forwarding_start;
+    // utilization and traffic counters
+    uint64_t busy = 0;
+    uint64_t weight_reads = 0;
+    // psums written to psum_out, per image of the batch
+    vector<uint64_t> image_psums;
+    sc_time psum_wait;
+    sc_time weight_wait;
 
 public:
-    SC_CTOR(processing_element) : clk("clk"), iact_in("iact_in"), weight_in("weight_in"), psum_in("psum_in"),
-                                  psum_out("psum_out"), fifo_1to2(1), fifo_2to3_act(1), fifo_2to3_w(1) {
+    SC_HAS_PROCESS(processing_element);
+
+    processing_element(sc_module_name name, const fifo_depths &depths = fifo_depths())
+        : sc_module(name), clk("clk"), iact_in("iact_in"), weight_in("weight_in"), psum_in("psum_in"),
+          psum_out("psum_out"), fifo_1to2("fifo_1to2", depths.fifo_1to2),
+          fifo_2to3_act("fifo_2to3_act", depths.fifo_2to3_act), fifo_2to3_w("fifo_2to3_w", depths.fifo_2to3_w),
+          fifo_psum_acc("fifo_psum_acc", depths.fifo_psum), fifo_psum_own("fifo_psum_own", depths.fifo_psum),
+          fifo_psum_fwd("fifo_psum_fwd", depths.fifo_psum) {
         SC_THREAD(stage1);
         sensitive << clk.pos();
 
         SC_THREAD(stage2);
         sensitive << clk.pos();
 
+        SC_THREAD(weight_loader);
+        sensitive << clk.pos();
+
         SC_THREAD(stage3);
         sensitive << clk.pos();
+
+        SC_THREAD(psum_demux);
+        sensitive << clk.pos();
+
+        SC_THREAD(psum_mux);
+        sensitive << clk.pos();
     }
 
     void set_config(config new_cfg) {
-        assert(new_cfg.kernel_w > 0);
-        assert(new_cfg.kernel_h > 0);
+        assert(new_cfg.valid());
 
         cfg = new_cfg;
+        image_psums.resize(max(image_psums.size(), cfg.batch));
+    }
+
+    // cycles spent by stage3 on multiply-accumulates and psum accumulation
+    uint64_t busy_cycles() const {
+        return busy;
+    }
+
+    // weights read from weight_in
+    uint64_t weight_loads() const {
+        return weight_reads;
+    }
+
+    // psums written to psum_out for each image of the batch
+    const vector<uint64_t> &psums_per_image() const {
+        return image_psums;
+    }
+
+    // time stage3 spent waiting for psum_in
+    const sc_time &psum_in_stall() const {
+        return psum_wait;
+    }
+
+    // time stage2 spent waiting for weights, i.e. the weight load latency that is not hidden
+    const sc_time &weight_stall() const {
+        return weight_wait;
+    }
+
+    void collect_fifo_stats(vector<fifo_stats> &stats) const {
+        stats.push_back(fifo_1to2.stats());
+        stats.push_back(fifo_2to3_act.stats());
+        stats.push_back(fifo_2to3_w.stats());
+        stats.push_back(fifo_psum_acc.stats());
+        stats.push_back(fifo_psum_own.stats());
+        stats.push_back(fifo_psum_fwd.stats());
     }
 
 private:
+    // batch index of the n-th psum produced
+    size_t psum_image(size_t n) const {
+        return cfg.ifmap_w > 0 ? (n / cfg.ofmap_w()) % cfg.batch : 0;
+    }
+
+    // pass of the n-th psum produced
+    size_t psum_pass(size_t n) const {
+        return cfg.ifmap_w > 0 ? (n / (cfg.ofmap_w() * cfg.batch)) % cfg.passes : 0;
+    }
+
     void stage1() {
         //while (true) {
         //    IAct_t iact;
@@ -119,41 +245,51 @@ private:
         //    MOD_DBG("stage 1: propagate iact");
         //}
 
-        // first sliding window generation
-        for (size_t i = 0; i < cfg.kernel_w; i++) {
-            IAct_t iact;
-
-            iact_in.read(iact);
-            wait(1);
-            fifo_1to2.write(iact);
-            if (i > 0) iact_win.push_back(iact);
-            MOD_DBG("stage 1: propagate iact");
-        }
-
         while (true) {
-            // we send first KW-1 window elements (which we already saved)
-            for (auto iact : iact_win) {
-                wait(1);
-                fifo_1to2.write(iact);
-                MOD_DBG("stage 1: propagate iact");
-            }
+            iact_win.clear();
 
-            // then the last one
-            {
+            // first sliding window generation
+            for (size_t i = 0; i < cfg.kernel_w; i++) {
                 IAct_t iact;
 
                 iact_in.read(iact);
                 wait(1);
                 fifo_1to2.write(iact);
-                iact_win.pop_front();
-                iact_win.push_back(iact);
+                if (i > 0) iact_win.push_back(iact);
                 MOD_DBG("stage 1: propagate iact");
             }
+
+            // one more window for each iact left in the row
+            for (size_t read = cfg.kernel_w; cfg.ifmap_w == 0 || read < cfg.ifmap_w; read++) {
+                // we send first KW-1 window elements (which we already saved)
+                for (auto iact : iact_win) {
+                    wait(1);
+                    fifo_1to2.write(iact);
+                    MOD_DBG("stage 1: propagate iact");
+                }
+
+                // then the last one
+                {
+                    IAct_t iact;
+
+                    iact_in.read(iact);
+                    wait(1);
+                    fifo_1to2.write(iact);
+                    // with 1-wide kernels there is no window to slide
+                    if (!iact_win.empty()) {
+                        iact_win.pop_front();
+                        iact_win.push_back(iact);
+                    }
+                    MOD_DBG("stage 1: propagate iact");
+                }
+            }
         }
     }
 
     void stage2() {
         size_t next_weight_ptr = 0;
+        // windows computed with the current weight row
+        size_t windows = 0;
 
         while (true) {
             IAct_t iact;
@@ -161,11 +297,34 @@ private:
 
             fifo_1to2.read(iact);
 
+            const sc_time wait_start = sc_time_stamp();
+
             if (weight_row.size() < next_weight_ptr + 1) {
-                weight_in.read(w);
-                weight_row.push_back(w);
+                if (shadow_armed) {
+                    // the shadow bank, filled while the previous row was in use, becomes the active one at a
+                    // window boundary
+                    while (!shadow_full) wait(shadow_loaded);
+
+                    weight_row.swap(shadow_row);
+                    shadow_full = false;
+                    shadow_free.notify(SC_ZERO_TIME);
+                } else {
+                    // weights are loaded lazily, on the first window after a weight row change
+                    weight_in.read(w);
+                    weight_row.push_back(w);
+                    weight_reads++;
+                    if (weight_row.size() == cfg.kernel_w) rows_loaded++;
+
+                    // with double buffering the loader takes over from the second row on
+                    if (cfg.double_buffer_weights && weight_row.size() == cfg.kernel_w) {
+                        shadow_armed = true;
+                        shadow_free.notify(SC_ZERO_TIME);
+                    }
+                }
             }
 
+            weight_wait += sc_time_stamp() - wait_start;
+
             w = weight_row[next_weight_ptr];
 
             wait(1);
@@ -175,16 +334,63 @@ private:
             MOD_DBG("stage 2: propagate weight column " << next_weight_ptr);
 
             next_weight_ptr = (next_weight_ptr + 1) % cfg.kernel_w;
+
+            // the weight row stays resident for a whole batch of ifmap rows, then the next one is loaded
+            if (next_weight_ptr == 0 && cfg.ifmap_w > 0 && ++windows == cfg.batch * cfg.ofmap_w()) {
+                weight_row.clear();
+                windows = 0;
+            }
+        }
+    }
+
+    // fills the shadow weight bank, one weight per cycle, whenever it has been swapped in; it only starts once
+    // stage2 arms the bank, so a config enabling double buffering after elaboration is picked up, and stops after
+    // the last weight row, instead of waiting on weight_in for one more
+    void weight_loader() {
+        while (true) {
+            while (!shadow_armed || shadow_full || (cfg.weight_rows > 0 && rows_loaded == cfg.weight_rows)) {
+                wait(shadow_free);
+            }
+
+            shadow_row.clear();
+
+            for (size_t i = 0; i < cfg.kernel_w; i++) {
+                W_t w;
+
+                weight_in.read(w);
+                shadow_row.push_back(w);
+                weight_reads++;
+                wait(1);
+                MOD_DBG("weight loader: shadow weight column " << i);
+            }
+
+            shadow_full = true;
+            rows_loaded++;
+            shadow_loaded.notify(SC_ZERO_TIME);
         }
     }
 
     void stage3() {
         PSum_t local_psum = 0;
         PSum_t remote_psum = 0;
+        // psums are tagged with the image (batch index) they belong to, and counted per image
+        size_t psums = 0;
+
+        while (cfg.psum_bypass) {
+            psum_in.read(remote_psum);
+            wait(1);
+            psum_out.write(remote_psum);
+            MOD_DBG("stage 3: bypass psum");
+        }
 
         while (true) {
             local_psum = 0;
 
+            if (cfg.psum_forward > 0 && !forwarding) {
+                forwarding = true;
+                forwarding_start.notify(SC_ZERO_TIME);
+            }
+
             for (size_t i = 0; i < cfg.kernel_w; i++) {
                 IAct_t iact;
                 W_t w;
@@ -193,29 +399,96 @@ private:
                 fifo_2to3_w.read(w);
 
                 local_psum = local_psum + iact * w;
+                busy++;
                 wait(1);
 
                 if (i == cfg.kernel_w - 1) {
-                    if (cfg.psum_acc_in) {
-                        psum_in.read(remote_psum);
+                    if (cfg.psum_acc_in || (cfg.psum_acc_spill && psum_pass(psums) > 0)) {
+                        const sc_time wait_start = sc_time_stamp();
+
+                        if (forwarding) {
+                            fifo_psum_acc.read(remote_psum);
+                        } else {
+                            psum_in.read(remote_psum);
+                        }
+                        psum_wait += sc_time_stamp() - wait_start;
                         local_psum += remote_psum;
+                        busy++;
                         wait(1);
                     }
 
-                    psum_out.write(local_psum);
-                    MOD_DBG("stage 3: propagate psum");
+                    if (forwarding) {
+                        fifo_psum_own.write(local_psum);
+                    } else {
+                        psum_out.write(local_psum);
+                    }
+                    MOD_DBG("stage 3: propagate psum of image " << psum_image(psums));
+                    image_psums[psum_image(psums)]++;
+                    psums++;
                 }
             }
         }
     }
+
+    // splits what comes through psum_in in each window: the psum to accumulate (if any) goes to stage3, the
+    // psums of the groups below are set aside for psum_mux
+    void psum_demux() {
+        while (!forwarding) wait(forwarding_start);
+
+        while (true) {
+            PSum_t psum;
+
+            if (cfg.psum_acc_in) {
+                psum_in.read(psum);
+                wait(1);
+                fifo_psum_acc.write(psum);
+            }
+
+            for (size_t i = 0; i < cfg.psum_forward; i++) {
+                psum_in.read(psum);
+                wait(1);
+                fifo_psum_fwd.write(psum);
+                MOD_DBG("psum demux: forward psum " << i);
+            }
+        }
+    }
+
+    // drives psum_out in each window: the psum of this PE first, then the ones of the groups below
+    void psum_mux() {
+        size_t windows = 0;
+
+        while (!forwarding) wait(forwarding_start);
+
+        while (true) {
+            PSum_t psum;
+
+            fifo_psum_own.read(psum);
+            wait(1);
+            psum_out.write(psum);
+
+            for (size_t i = 0; i < cfg.psum_forward; i++) {
+                fifo_psum_fwd.read(psum);
+                wait(1);
+                psum_out.write(psum);
+            }
+
+            // forwarded psums belong to the same image as the window they come with
+            image_psums[psum_image(windows)] += cfg.psum_forward;
+            windows++;
+        }
+    }
 };
 
 template <typename W_t, typename IAct_t, typename PSum_t, size_t PERows, size_t PECols, size_t IActBanks>
 SC_MODULE(pe_cluster) {
     typedef processing_element<W_t, IAct_t, PSum_t> pe;
-    typedef sc_fifo<IAct_t> ififo;
-    typedef sc_fifo<W_t> wfifo;
-    typedef sc_fifo<PSum_t> pfifo;
+
+    // largest depth allowed for the propagation fifos, their inline storage
+    static constexpr size_t max_fifo_depth = 256;
+
+    typedef spsc_fifo<IAct_t, max_fifo_depth> ififo;
+    typedef spsc_fifo<W_t, max_fifo_depth> wfifo;
+    typedef spsc_fifo<PSum_t, max_fifo_depth> pfifo;
     typedef sc_fifo_in<IAct_t> ififo_in;
     typedef sc_fifo_in<W_t> wfifo_in;
     typedef sc_fifo_in<PSum_t> pfifo_in;
@@ -225,6 +498,32 @@ SC_MODULE(pe_cluster) {
         mcast_config<IActBanks, PERows * PECols> iact_propagation;
         array<mcast_config<1, PECols>, PERows> weight_propagation;
         typename pe::config pe_config;
+
+        // scatter injection: with a non-zero chunk, a source sends chunks of that many elements to one lane of its
+        // destinations at a time, cycling through the lanes it reaches in increasing order
+        // with a zero chunk every element is multicast to all the destinations
+        size_t iact_chunk = 0;
+        array<size_t, PERows * PECols> iact_lane{};
+        size_t weight_chunk = 0;
+        array<array<size_t, PECols>, PERows> weight_lane{};
+
+        // the bottom row accumulates the psums coming through psum_in, e.g. those of another cluster working on
+        // other input channels
+        bool psum_chain = false;
+
+        // groups of kernel_h rows stacked along the columns, each one producing psums of its own (e.g. the channels
+        // of a depthwise layer): in each window the top group's psum leaves through psum_out first, followed by
+        // those of the groups below, forwarded up the column (see pe::config::psum_forward)
+        size_t stacked_groups = 1;
+    };
+
+    // depths of the propagation fifos and of the PE pipelines, fixed at construction
+    // propagation links default to the sc_fifo depth
+    struct fifo_depths {
+        size_t iact = 16;
+        size_t weight = 16;
+        size_t psum = 16;
+        typename pe::fifo_depths pe_depths;
     };
 
     // PE cluster interface
@@ -243,7 +542,7 @@ private:
     // internal structure
     array<array<pe *, PECols>, PERows> grid;
     // iact propagation FIFOs - 1 per PE
-    array<array<ififo, PECols>, IActBanks> iact_fifos;
+    array<array<ififo, PECols>, PERows> iact_fifos;
     // weight propagation fifos - 1 per PE
     array<array<wfifo, PECols>, PERows> weight_fifos;
     // psum propagation fifos - 1 per PE minus row 0
@@ -252,12 +551,27 @@ private:
     config cfg;
 
 public:
-    SC_CTOR(pe_cluster) {
+    SC_HAS_PROCESS(pe_cluster);
+
+    pe_cluster(sc_module_name name, const fifo_depths &depths = fifo_depths()) : sc_module(name) {
+        // the fifos are built with their full capacity, set_depth only bounds the part in use (and checks it)
+        for (auto &bank : iact_fifos) {
+            for (auto &f : bank) f.set_depth(depths.iact);
+        }
+
+        for (auto &row : weight_fifos) {
+            for (auto &f : row) f.set_depth(depths.weight);
+        }
+
+        for (auto &row : psum_fifos) {
+            for (auto &f : row) f.set_depth(depths.psum);
+        }
+
         // we generate rows from the last one
         for (ssize_t row = PERows - 1; row >= 0; row--) {
             for (size_t col = 0; col < PECols; col++) {
                 const string name = "pe_" + to_string(row) + "_" + to_string(col);
-                pe *p = new pe(name.c_str());
+                pe *p = new pe(name.c_str(), depths.pe_depths);
 
                 p->clk(clk);
 
@@ -326,6 +640,19 @@ public:
             throw runtime_error(string(name()) + " invalid PE cluster configuration (PE)");
         }
 
+        if (cfg.stacked_groups == 0 || cfg.pe_config.kernel_h * cfg.stacked_groups > PERows) {
+            throw runtime_error(string(name()) + " invalid PE cluster configuration (kernel_h)");
+        }
+
+        if (cfg.stacked_groups > 1 && (cfg.psum_chain || cfg.pe_config.passes > 1)) {
+            throw runtime_error(string(name()) + " stacked groups need a single pass and no psum chaining");
+        }
+
+        if (cfg.psum_chain && cfg.pe_config.passes > 1) {
+            throw runtime_error(string(name()) + " psum chaining needs a single pass");
+        }
+
+#ifdef CONVSIM_MOD_DBG
         cerr << "PE cluster " << name() << endl;
         cerr << "Setting new iact multicast configuration" << endl;
         cfg.iact_propagation.print(cerr);
@@ -333,46 +660,323 @@ public:
         for (auto &row : cfg.weight_propagation) {
             row.print(cerr);
         }
+#endif
+
+        // lanes reached by each source, in scatter order
+        for (size_t bank = 0; bank < IActBanks; bank++) {
+            iact_lanes[bank].clear();
+
+            for (size_t pos = 0; pos < PERows * PECols; pos++) {
+                if (cfg.iact_propagation.path(bank, pos)) iact_lanes[bank].push_back(cfg.iact_lane[pos]);
+            }
+
+            sort_lanes(iact_lanes[bank]);
+        }
 
-        cerr << "Setting new PE configuration" << endl;
         for (size_t row = 0; row < PERows; row++) {
+            weight_lanes[row].clear();
+
             for (size_t col = 0; col < PECols; col++) {
-                cfg.pe_config.psum_acc_in = row < (cfg.pe_config.kernel_h - 1);
+                if (cfg.weight_propagation[row].path(0, col)) weight_lanes[row].push_back(cfg.weight_lane[row][col]);
+            }
+
+            sort_lanes(weight_lanes[row]);
+        }
+
+        // spilled or chained psums come through psum_in, which feeds the last row: the rows below the mapping pass
+        // them up to its bottom row
+        // with stacked groups, the bottom row of each group starts its own psums, and forwards those of the groups
+        // below it
+        const size_t group_h = cfg.pe_config.kernel_h;
+        const size_t bottom = group_h * cfg.stacked_groups - 1;
+        const bool psums_from_below = cfg.pe_config.passes > 1 || cfg.psum_chain;
+
+        MOD_DBG("setting new PE configuration");
+        for (size_t row = 0; row < PERows; row++) {
+            for (size_t col = 0; col < PECols; col++) {
+                cfg.pe_config.psum_acc_in = (row <= bottom && row % group_h < group_h - 1) ||
+                                            (row == bottom && cfg.psum_chain);
+                cfg.pe_config.psum_acc_spill = row == bottom;
+                cfg.pe_config.psum_bypass = row > bottom && psums_from_below;
+                cfg.pe_config.psum_forward = row <= bottom ? cfg.stacked_groups - 1 - row / group_h : 0;
                 grid[row][col]->set_config(cfg.pe_config);
             }
         }
     }
 
+    // mapping modes: cluster configurations for the supported layer types (the caller sets the remaining PE
+    // configuration fields, e.g. batch)
+
+    // dense 2D convolution: PE (r, c) convolves ifmap row r + c with kernel row r, so column c produces ofmap row c
+    static config conv_mapping(size_t kernel_h, size_t kernel_w, size_t ofmap_h, size_t ifmap_w) {
+        config cfg;
+
+        for (size_t row = 0; row < kernel_h; row++) {
+            for (size_t col = 0; col < ofmap_h; col++) {
+                cfg.iact_propagation.groupEnable(row + col, {row * PECols + col});
+                cfg.weight_propagation[row].groupEnable(0, {col});
+            }
+        }
+
+        cfg.pe_config.kernel_w = kernel_w;
+        cfg.pe_config.kernel_h = kernel_h;
+        cfg.pe_config.ifmap_w = ifmap_w;
+
+        return cfg;
+    }
+
+    // channel groups of a depthwise layer side by side, and stacked along the columns
+    static size_t depthwise_columns(size_t ofmap_h) {
+        return PECols / ofmap_h;
+    }
+
+    // a window takes kernel_w + 1 cycles in the rows that accumulate, so row 0 can't send out the psums of more
+    // groups than that
+    static size_t depthwise_stack(size_t kernel_h, size_t kernel_w) {
+        return min(PERows / kernel_h, kernel_w + 1);
+    }
+
+    // channels convolved at once by a depthwise layer: group q = v * depthwise_columns() + g is the g-th one from
+    // the left in the v-th row of groups from the top
+    static size_t depthwise_groups(size_t kernel_h, size_t kernel_w, size_t ofmap_h) {
+        return depthwise_columns(ofmap_h) * depthwise_stack(kernel_h, kernel_w);
+    }
+
+    // bank feeding ifmap row h of depthwise group q: the kernel_h + ofmap_h - 1 rows of a group go to consecutive
+    // banks, and the groups follow each other around all the banks, so that they are spread evenly
+    static size_t depthwise_bank(size_t kernel_h, size_t ofmap_h, size_t q, size_t h) {
+        return (q * (kernel_h + ofmap_h - 1) + h) % IActBanks;
+    }
+
+    // depthwise convolution: each group of kernel_h rows and ofmap_h columns is a conv_mapping for its own channel;
+    // the groups are stacked too (stacked_groups), as a depthwise layer has no reduction across channels to fill
+    // the rows below kernel_h with
+    // a bank is shared by a few groups, and alternates them one iact at a time (in group order), so that they all
+    // progress together; weight rows scatter one kernel row per group of the row, in group order
+    static config depthwise_mapping(size_t kernel_h, size_t kernel_w, size_t ofmap_h, size_t ifmap_w) {
+        config cfg;
+        const size_t columns = depthwise_columns(ofmap_h);
+        const size_t stack = depthwise_stack(kernel_h, kernel_w);
+
+        for (size_t v = 0; v < stack; v++) {
+            for (size_t g = 0; g < columns; g++) {
+                const size_t q = v * columns + g;
+
+                for (size_t r = 0; r < kernel_h; r++) {
+                    for (size_t e = 0; e < ofmap_h; e++) {
+                        const size_t row = v * kernel_h + r;
+                        const size_t col = g * ofmap_h + e;
+
+                        cfg.iact_propagation.groupEnable(depthwise_bank(kernel_h, ofmap_h, q, r + e),
+                                                         {row * PECols + col});
+                        cfg.iact_lane[row * PECols + col] = q;
+                        cfg.weight_propagation[row].groupEnable(0, {col});
+                        cfg.weight_lane[row][col] = g;
+                    }
+                }
+            }
+        }
+
+        cfg.iact_chunk = 1;
+        cfg.weight_chunk = kernel_w;
+        cfg.stacked_groups = stack;
+
+        cfg.pe_config.kernel_w = kernel_w;
+        cfg.pe_config.kernel_h = kernel_h;
+        cfg.pe_config.ifmap_w = ifmap_w;
+
+        return cfg;
+    }
+
+    // input channels per PE row of a pointwise layer
+    static size_t pointwise_chunk(size_t channels) {
+        return (channels + PERows - 1) / PERows;
+    }
+
+    // rows used by a pointwise layer
+    static size_t pointwise_rows(size_t channels) {
+        const size_t chunk = pointwise_chunk(channels);
+        return (channels + chunk - 1) / chunk;
+    }
+
+    // pointwise (1x1) convolution: PE (r, c) holds the weights of filter c for the r-th chunk of input channels as
+    // its filter row, and takes the same chunk of every pixel as an ifmap row of a single window, so it produces a
+    // psum per pixel; psums are reduced over the chunks along the columns
+    // the filter row stays resident for all the pixels (as a batch of ifmap rows)
+    // row r gets its chunk of each pixel multicast from bank r, filter rows are scattered one per column
+    static config pointwise_mapping(size_t channels, size_t filters, size_t pixels) {
+        config cfg;
+        const size_t chunk = pointwise_chunk(channels);
+
+        for (size_t row = 0; row < pointwise_rows(channels); row++) {
+            for (size_t col = 0; col < filters; col++) {
+                cfg.iact_propagation.groupEnable(row, {row * PECols + col});
+                cfg.weight_propagation[row].groupEnable(0, {col});
+                cfg.weight_lane[row][col] = col;
+            }
+        }
+
+        cfg.weight_chunk = chunk;
+
+        cfg.pe_config.kernel_w = chunk;
+        cfg.pe_config.kernel_h = pointwise_rows(channels);
+        cfg.pe_config.ifmap_w = chunk;
+        cfg.pe_config.batch = pixels;
+
+        return cfg;
+    }
+
+    // fully-connected layer: a pointwise convolution whose pixels are the images of the batch
+    static config fully_connected_mapping(size_t features, size_t outputs, size_t batch) {
+        return pointwise_mapping(features, outputs, batch);
+    }
+
+    // sum of the busy cycles of all the PEs
+    uint64_t busy_cycles() const {
+        uint64_t busy = 0;
+
+        for (auto &row : grid) {
+            for (auto p : row) busy += p->busy_cycles();
+        }
+
+        return busy;
+    }
+
+    // psums that left the cluster through psum_out for each image of the batch, over all the columns
+    vector<uint64_t> psums_per_image() const {
+        vector<uint64_t> psums;
+
+        for (auto p : grid[0]) {
+            const vector<uint64_t> &n = p->psums_per_image();
+
+            psums.resize(max(psums.size(), n.size()));
+            for (size_t i = 0; i < n.size(); i++) psums[i] += n[i];
+        }
+
+        return psums;
+    }
+
+    // time the PEs of a row spent waiting for psum_in
+    sc_time psum_in_stall(size_t row) const {
+        sc_time stall;
+
+        for (auto p : grid[row]) stall += p->psum_in_stall();
+
+        return stall;
+    }
+
+    // time all the PEs spent waiting for weights
+    sc_time weight_stall() const {
+        sc_time stall;
+
+        for (auto &row : grid) {
+            for (auto p : row) stall += p->weight_stall();
+        }
+
+        return stall;
+    }
+
+    // sum of the weights loaded by all the PEs
+    uint64_t weight_loads() const {
+        uint64_t loads = 0;
+
+        for (auto &row : grid) {
+            for (auto p : row) loads += p->weight_loads();
+        }
+
+        return loads;
+    }
+
+    // occupancy statistics of every fifo in the cluster, PE pipelines included
+    // propagation fifos are reported as <cluster>.<kind>_<row>_<col>, PE fifos with their own names
+    vector<fifo_stats> collect_fifo_stats() const {
+        vector<fifo_stats> stats;
+
+        auto collect = [&](const char *kind, size_t row, size_t col, const fifo_stats &s) {
+            stats.push_back(s);
+            stats.back().name = string(name()) + "." + kind + "_" + to_string(row) + "_" + to_string(col);
+        };
+
+        for (size_t row = 0; row < iact_fifos.size(); row++) {
+            for (size_t col = 0; col < PECols; col++) collect("iact", row, col, iact_fifos[row][col].stats());
+        }
+
+        for (size_t row = 0; row < weight_fifos.size(); row++) {
+            for (size_t col = 0; col < PECols; col++) collect("weight", row, col, weight_fifos[row][col].stats());
+        }
+
+        for (size_t row = 0; row < psum_fifos.size(); row++) {
+            for (size_t col = 0; col < PECols; col++) collect("psum", row, col, psum_fifos[row][col].stats());
+        }
+
+        for (auto &row : grid) {
+            for (auto p : row) p->collect_fifo_stats(stats);
+        }
+
+        return stats;
+    }
+
 private:
+    // lanes reached by each iact bank and weight row, in increasing order
+    array<vector<size_t>, IActBanks> iact_lanes;
+    array<vector<size_t>, PERows> weight_lanes;
+
+    static void sort_lanes(vector<size_t> &lanes) {
+        sort(lanes.begin(), lanes.end());
+        lanes.erase(unique(lanes.begin(), lanes.end()), lanes.end());
+    }
+
     void iact_thread(int bank) {
         IAct_t iact;
+        // scatter state: current lane and elements already sent to it
+        size_t lane = 0;
+        size_t sent = 0;
 
         while (true) {
             iact_in[bank].read(iact);
             wait(1);
 
+            const bool scatter = cfg.iact_chunk > 0 && !iact_lanes[bank].empty();
+
             for (size_t pos = 0; pos < PERows * PECols; pos++) {
                 // each PE has an iact fifo... check if we should send there
-                if (cfg.iact_propagation.path(bank, pos)) {
+                if (cfg.iact_propagation.path(bank, pos) &&
+                    (!scatter || cfg.iact_lane[pos] == iact_lanes[bank][lane])) {
                     iact_fifos[pos / PECols][pos % PECols].write(iact);
                 }
             }
+
+            if (scatter && ++sent == cfg.iact_chunk) {
+                sent = 0;
+                lane = (lane + 1) % iact_lanes[bank].size();
+            }
         }
     }
 
     void weight_thread(int row) {
         W_t weight;
+        // scatter state: current lane and elements already sent to it
+        size_t lane = 0;
+        size_t sent = 0;
 
         while (true) {
             weight_in[row].read(weight);
             wait(1);
 
+            const bool scatter = cfg.weight_chunk > 0 && !weight_lanes[row].empty();
+
             for (size_t pos = 0; pos < PECols; pos++) {
                 // each PE in this row has a weight fifo... check if we should send there
-                if (cfg.weight_propagation[row].path(0, pos)) {
+                if (cfg.weight_propagation[row].path(0, pos) &&
+                    (!scatter || cfg.weight_lane[row][pos] == weight_lanes[row][lane])) {
                     weight_fifos[row][pos % PECols].write(weight);
                 }
             }
+
+            if (scatter && ++sent == cfg.weight_chunk) {
+                sent = 0;
+                lane = (lane + 1) % weight_lanes[row].size();
+            }
         }
     }
 };
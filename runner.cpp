@@ -0,0 +1,298 @@
+#include "runner.h"
+
+#include <poll.h>
+#include <signal.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <sstream>
+#include <stdexcept>
+
+using namespace convsim;
+using namespace convsim::tests;
+
+child_process::child_process(const function<string()> &body) {
+    int fds[2];
+
+    if (pipe(fds) != 0) {
+        throw runtime_error(string("pipe failed: ") + strerror(errno));
+    }
+
+    // don't let the child replay buffered output
+    cout.flush();
+    cerr.flush();
+
+    child = fork();
+
+    if (child < 0) {
+        throw runtime_error(string("fork failed: ") + strerror(errno));
+    }
+
+    if (child == 0) {
+        close(fds[0]);
+
+        int status = 0;
+        string result;
+
+        try {
+            result = body();
+        } catch (exception &e) {
+            cerr << "Error: " << e.what() << endl;
+            status = 1;
+        }
+
+        for (size_t done = 0; done < result.size();) {
+            const ssize_t n = write(fds[1], result.data() + done, result.size() - done);
+            if (n <= 0) {
+                status = 1;
+                break;
+            }
+            done += n;
+        }
+
+        cout.flush();
+        cerr.flush();
+        // skip the parent's destructors and atexit handlers
+        _exit(status);
+    }
+
+    close(fds[1]);
+    out_fd = fds[0];
+}
+
+child_process::~child_process() {
+    if (out_fd >= 0) close(out_fd);
+    if (child > 0) waitpid(child, nullptr, 0);
+}
+
+bool child_process::read_output() {
+    char buf[4096];
+    const ssize_t n = read(out_fd, buf, sizeof(buf));
+
+    if (n < 0 && errno == EINTR) return true;
+    if (n <= 0) return false;
+
+    output.append(buf, n);
+    return true;
+}
+
+child_result child_process::join() {
+    while (read_output()) {
+    }
+
+    int status;
+    struct rusage usage;
+
+    if (wait4(child, &status, 0, &usage) != child) {
+        throw runtime_error(string("wait4 failed: ") + strerror(errno));
+    }
+
+    close(out_fd);
+    out_fd = -1;
+    child = -1;
+
+    const double cpu_s = usage.ru_utime.tv_sec + usage.ru_stime.tv_sec +
+                         (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) * 1e-6;
+
+    return {WIFEXITED(status) && WEXITSTATUS(status) == 0, output, usage.ru_maxrss, cpu_s};
+}
+
+child_result convsim::run_in_child(const function<string()> &body) {
+    return child_process(body).join();
+}
+
+function<string()> convsim::testbench_job(const function<testbench *()> &make, double clk_period_ns,
+                                          const report_hook &extra) {
+    return [make, clk_period_ns, extra]() {
+        sc_clock clk("clk", clk_period_ns, SC_NS);
+
+        // the child exits right after the simulation, so the testbench is never deleted
+        testbench *tb = make();
+        tb->clk(clk);
+
+        const auto start = chrono::steady_clock::now();
+        sc_start();
+        const chrono::duration<double> wall = chrono::steady_clock::now() - start;
+
+        json::value out;
+        out["passed"] = tb->passed;
+        out["cycles"] = llround(tb->elapsed / clk.period());
+        out["wall_s"] = wall.count();
+        // SystemC doesn't expose process activations, delta cycles are the closest kernel activity counter
+        out["delta_cycles"] = static_cast<uint64_t>(sc_delta_count());
+
+        if (extra) extra(tb, clk, out);
+
+        return out.dump();
+    };
+}
+
+json::value convsim::testbench_report(const child_result &child) {
+    json::value report;
+
+    if (child.ok) {
+        report = json::parse(child.output);
+    } else {
+        report["passed"] = false;
+    }
+
+    report["peak_rss_kb"] = child.max_rss_kb;
+    report["cpu_s"] = child.cpu_s;
+
+    return report;
+}
+
+json::value convsim::run_partitioned(partition_set &parts, const function<testbench *(size_t)> &make,
+                                     double clk_period_ns, const report_hook &extra) {
+    const auto start = chrono::steady_clock::now();
+
+    map<int, pair<size_t, unique_ptr<child_process>>> running;
+    vector<json::value> reports(parts.size());
+    bool failed = false;
+
+    for (size_t p = 0; p < parts.size(); p++) {
+        const function<string()> sim = testbench_job([&make, p]() { return make(p); }, clk_period_ns, extra);
+
+        auto child = unique_ptr<child_process>(new child_process([&parts, p, sim]() {
+            parts.select(p);
+
+            const string out = sim();
+
+            // the peers may still be simulating cycles this partition won't reach
+            parts.finish(p);
+            return out;
+        }));
+        const int fd = child->fd();
+
+        running[fd] = make_pair(p, move(child));
+    }
+
+    while (!running.empty()) {
+        vector<pollfd> fds;
+        for (auto &r : running) fds.push_back({r.first, POLLIN, 0});
+
+        if (poll(fds.data(), fds.size(), -1) < 0) {
+            if (errno == EINTR) continue;
+            throw runtime_error(string("poll failed: ") + strerror(errno));
+        }
+
+        for (auto &f : fds) {
+            if (!f.revents) continue;
+
+            auto it = running.find(f.fd);
+            if (it->second.second->read_output()) continue;
+
+            // the child is done
+            const size_t p = it->second.first;
+            const child_result child = it->second.second->join();
+            running.erase(it);
+
+            reports[p] = testbench_report(child);
+
+            if (!child.ok && !failed) {
+                failed = true;
+                for (auto &r : running) kill(r.second.second->pid(), SIGKILL);
+            }
+        }
+    }
+
+    const chrono::duration<double> wall = chrono::steady_clock::now() - start;
+
+    json::value out;
+    json::value partitions = json::value::array();
+    bool passed = !failed;
+    double cycles = 0;
+    double delta_cycles = 0;
+
+    for (auto &r : reports) {
+        passed = passed && r.at("passed").as_bool();
+        cycles = max(cycles, r.get_number("cycles", 0));
+        delta_cycles += r.get_number("delta_cycles", 0);
+        partitions.push_back(r);
+    }
+
+    out["passed"] = passed;
+    out["cycles"] = cycles;
+    out["wall_s"] = wall.count();
+    out["delta_cycles"] = delta_cycles;
+    out["partitions"] = partitions;
+
+    return out;
+}
+
+const char *const convsim::array_names = "4x4|12x14|32x32";
+
+bool convsim::known_array(const string &array) {
+    return array == "4x4" || array == "12x14" || array == "32x32";
+}
+
+vector<size_t> convsim::parse_sizes(const string &list) {
+    vector<size_t> items;
+    stringstream ss(list);
+    string item;
+
+    while (getline(ss, item, ',')) items.push_back(stoul(item));
+
+    return items;
+}
+
+vector<double> convsim::parse_numbers(const string &list) {
+    vector<double> items;
+    stringstream ss(list);
+    string item;
+
+    while (getline(ss, item, ',')) items.push_back(stod(item));
+
+    return items;
+}
+
+bool convsim::parse_tool_options(int argc, char *argv[], bool takes_array, const string &usage,
+                                 tool_options &common, const option_handler &handle) {
+    for (int i = 1; i < argc; i += 2) {
+        const string name = argv[i];
+        bool ok = i + 1 < argc;
+
+        if (ok) {
+            const string value = argv[i + 1];
+
+            try {
+                if (name == "--out") {
+                    common.out_path = value;
+                } else if (takes_array && name == "--array") {
+                    common.array = value;
+                    ok = known_array(value);
+                } else {
+                    ok = handle(name, value);
+                }
+            } catch (logic_error &) {
+                // stoul and friends on a malformed value
+                ok = false;
+            }
+        }
+
+        if (!ok) {
+            cerr << "usage: " << argv[0] << (takes_array ? string(" [--array ") + array_names + "]" : "")
+                 << (usage.empty() ? "" : " ") << usage << " [--out FILE]" << endl;
+            return false;
+        }
+    }
+
+    return true;
+}
+
+void convsim::write_output(const string &text, const string &path) {
+    if (path.empty()) {
+        cout << text;
+    } else {
+        ofstream(path) << text;
+    }
+}
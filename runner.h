@@ -0,0 +1,135 @@
+#pragma once
+
+#include <sys/types.h>
+
+#include <functional>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "json.h"
+#include "partition.h"
+#include "reference.h"
+#include "tests.h"
+
+namespace convsim {
+
+using namespace std;
+
+// SystemC elaborates and simulates only once per process, so independent simulations run in forked children
+// that send their result back through a pipe
+struct child_result {
+    // the child returned normally
+    bool ok;
+    // what the child body returned
+    string output;
+    // peak resident set size of the child
+    long max_rss_kb;
+    // CPU time (user and system) of the child
+    double cpu_s;
+};
+
+class child_process {
+public:
+    // forks and runs body in the child: nothing must have been elaborated in the parent yet
+    explicit child_process(const function<string()> &body);
+    ~child_process();
+
+    child_process(const child_process &) = delete;
+    child_process &operator=(const child_process &) = delete;
+
+    pid_t pid() const { return child; }
+    // read end of the result pipe, to be polled when running several children at once
+    int fd() const { return out_fd; }
+
+    // reads what the child has written so far, returns false once the child has closed the pipe
+    bool read_output();
+    // waits for the child to exit and collects its result
+    child_result join();
+
+private:
+    pid_t child;
+    int out_fd;
+    string output;
+};
+
+// runs body in a child process and waits for it
+child_result run_in_child(const function<string()> &body);
+
+// adds testbench specific results to the report of a finished simulation
+typedef function<void(tests::testbench *, const sc_core::sc_clock &, json::value &)> report_hook;
+
+// child body that elaborates a testbench (as first and last one), simulates it to the end and reports passed,
+// cycles, wall_s and delta_cycles (plus whatever extra adds) as a JSON object
+function<string()> testbench_job(const function<tests::testbench *()> &make, double clk_period_ns,
+                                 const report_hook &extra = nullptr);
+
+// decodes the output of a testbench_job child, adding its peak RSS and CPU time
+json::value testbench_report(const child_result &child);
+
+// partitioned simulation: one child per partition, simulating the testbench make elaborates for it (as first and
+// last one), all at once; the reports are merged into passed (by all the partitions), cycles (of the slowest one),
+// wall_s (of the whole run) and delta_cycles (of all the partitions), with the report of each partition in
+// partitions
+// if a child fails the others are killed, as they might wait for it forever
+json::value run_partitioned(partition_set &parts, const function<tests::testbench *(size_t)> &make,
+                            double clk_period_ns, const report_hook &extra = nullptr);
+
+// cluster geometries are template parameters, so the tools support a fixed set of arrays, named <rows>x<cols>
+extern const char *const array_names;
+
+bool known_array(const string &array);
+
+template <size_t Rows, size_t Cols>
+struct array_size {
+    static constexpr size_t rows = Rows;
+    static constexpr size_t cols = Cols;
+};
+
+// calls f with the array_size of the named array, e.g. f(array_size<12, 14>()) for "12x14"
+template <typename F>
+auto with_array(const string &array, F &&f) {
+    if (array == "4x4") return f(array_size<4, 4>());
+    if (array == "12x14") return f(array_size<12, 14>());
+    if (array == "32x32") return f(array_size<32, 32>());
+
+    throw runtime_error("unknown array " + array);
+}
+
+// a convolution filling the whole array: one kernel row per PE row, one ofmap row per PE column
+template <size_t Rows, size_t Cols>
+reference::conv_shape full_array_conv(size_t kernel_w, size_t ifmap_w) {
+    reference::conv_shape shape;
+
+    shape.kernel_h = Rows;
+    shape.kernel_w = kernel_w;
+    shape.ifmap_h = Rows + Cols - 1;
+    shape.ifmap_w = ifmap_w;
+
+    return shape;
+}
+
+// comma separated lists, e.g. 1,2,4
+vector<size_t> parse_sizes(const string &list);
+vector<double> parse_numbers(const string &list);
+
+// command line options shared by the tools
+struct tool_options {
+    string array = "12x14";
+    string out_path;
+};
+
+// parses a tool specific option, returns false if the tool doesn't have it
+typedef function<bool(const string &name, const string &value)> option_handler;
+
+// parses the command line as --name value pairs: --out (and --array, if the tool takes it) into common, the others
+// through handle
+// prints the usage, with the tool specific options in usage, and returns false on a missing or malformed value or
+// an unknown option
+bool parse_tool_options(int argc, char *argv[], bool takes_array, const string &usage, tool_options &common,
+                        const option_handler &handle);
+
+// writes the output of a tool to path, or to stdout without one
+void write_output(const string &text, const string &path);
+
+}
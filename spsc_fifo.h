@@ -0,0 +1,181 @@
+#pragma once
+
+#include <systemc>
+
+#include <algorithm>
+#include <array>
+#include <string>
+#include <typeinfo>
+
+namespace convsim {
+
+using namespace std;
+using namespace sc_core;
+
+// occupancy statistics of a channel
+struct fifo_stats {
+    string name;
+    size_t depth;
+    // maximum number of elements stored at once
+    size_t high_water;
+    // total time the writer spent blocked on a full channel
+    sc_time full_stall;
+};
+
+// Lightweight single-producer/single-consumer channel, a drop-in replacement for sc_fifo on internal links.
+// Differences with sc_fifo:
+// - storage is a fixed inline ring buffer of Capacity elements (no allocation at all), of which only the first
+//   depth are used: depth is chosen at construction or before the simulation starts, up to Capacity
+// - there is no update phase: an element is visible to the reader as soon as it has been written
+// - data_written_event is notified only on empty -> non-empty transitions, data_read_event only on
+//   full -> non-full transitions (notifications are delta, as in sc_fifo)
+template <typename T, size_t Capacity>
+class spsc_fifo : public sc_fifo_in_if<T>, public sc_fifo_out_if<T>, public sc_prim_channel {
+    static_assert(Capacity > 0, "spsc_fifo capacity must be positive");
+
+public:
+    explicit spsc_fifo(size_t depth = Capacity) : sc_prim_channel(sc_gen_unique_name("spsc_fifo")) {
+        set_depth(depth);
+    }
+
+    explicit spsc_fifo(const char *name, size_t depth = Capacity) : sc_prim_channel(name) {
+        set_depth(depth);
+    }
+
+    void set_depth(size_t new_depth) {
+        if (new_depth == 0 || new_depth > Capacity) {
+            throw runtime_error(string(name()) + " spsc_fifo depth must be between 1 and " + to_string(Capacity));
+        }
+
+        if (count > 0) throw runtime_error(string(name()) + " spsc_fifo resized while holding elements");
+
+        depth = new_depth;
+        head = 0;
+    }
+
+    virtual void register_port(sc_port_base &port, const char *if_typename) override {
+        const string nm(if_typename);
+
+        // like sc_fifo, we allow only one reader and one writer
+        if (nm == typeid(sc_fifo_in_if<T>).name()) {
+            if (reader) throw runtime_error(string(name()) + " spsc_fifo has more than one reader");
+            reader = &port;
+        } else if (nm == typeid(sc_fifo_out_if<T>).name()) {
+            if (writer) throw runtime_error(string(name()) + " spsc_fifo has more than one writer");
+            writer = &port;
+        }
+    }
+
+    // blocking interface
+    virtual void read(T &val) override {
+        while (count == 0) sc_core::wait(written_event);
+        pop(val);
+    }
+
+    virtual T read() override {
+        T val;
+        read(val);
+        return val;
+    }
+
+    virtual void write(const T &val) override {
+        if (count == depth) {
+            const sc_time stall_start = sc_time_stamp();
+
+            while (count == depth) sc_core::wait(read_event);
+            full_stall += sc_time_stamp() - stall_start;
+        }
+
+        push(val);
+    }
+
+    // non-blocking interface
+    virtual bool nb_read(T &val) override {
+        if (count == 0) return false;
+        pop(val);
+        return true;
+    }
+
+    virtual bool nb_write(const T &val) override {
+        if (count == depth) return false;
+        push(val);
+        return true;
+    }
+
+    virtual int num_available() const override {
+        return count;
+    }
+
+    virtual int num_free() const override {
+        return depth - count;
+    }
+
+    virtual const sc_event &data_written_event() const override {
+        return written_event;
+    }
+
+    virtual const sc_event &data_read_event() const override {
+        return read_event;
+    }
+
+    virtual const sc_event &default_event() const override {
+        return written_event;
+    }
+
+    virtual const char *kind() const override {
+        return "spsc_fifo";
+    }
+
+    // number of event notifications issued so far
+    uint64_t num_notifications() const {
+        return notifications;
+    }
+
+    fifo_stats stats() const {
+        return {name(), depth, high_water, full_stall};
+    }
+
+private:
+    void push(const T &val) {
+        const size_t tail = head + count;
+
+        buf[tail < depth ? tail : tail - depth] = val;
+        count++;
+        high_water = max(high_water, count);
+
+        // wake up the reader only if it could have been waiting
+        if (count == 1) {
+            written_event.notify(SC_ZERO_TIME);
+            notifications++;
+        }
+    }
+
+    void pop(T &val) {
+        val = buf[head];
+        if (++head == depth) head = 0;
+        count--;
+
+        // wake up the writer only if it could have been waiting
+        if (count == depth - 1) {
+            read_event.notify(SC_ZERO_TIME);
+            notifications++;
+        }
+    }
+
+    array<T, Capacity> buf;
+    size_t depth;
+    size_t head = 0;
+    size_t count = 0;
+
+    size_t high_water = 0;
+    sc_time full_stall;
+
+    sc_event written_event;
+    sc_event read_event;
+    uint64_t notifications = 0;
+
+    sc_port_base *reader = nullptr;
+    sc_port_base *writer = nullptr;
+};
+
+}
@@ -92,20 +92,29 @@ SC_MODULE(router) {
         // first we validate the new configuration
         if (!cfg.valid()) throw runtime_error(string(name()) + " invalid router configuration");
 
+#ifdef CONVSIM_MOD_DBG
         cerr << "Router " << name() << endl;
         cerr << "Setting new circuit configuration" << endl;
         cfg.print(cerr);
+#endif
+    }
+
+    // flits received on all the source ports so far, each one takes a cycle of its port
+    uint64_t flits() const {
+        return n_flits;
     }
 
 private:
     // the route configuration
     config cfg;
+    uint64_t n_flits = 0;
 
     void port_thread(direction src) {
         DataType data_in;
 
         while (true) {
             in[src].read(data_in);
+            n_flits++;
             wait(1);
 
             for (size_t dst = 0; dst < N_DIRECTIONS; dst++) {
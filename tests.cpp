@@ -1,5 +1,7 @@
 #include "tests.h"
 
+#include <chrono>
+
 using namespace convsim;
 using namespace convsim::row_stationary;
 using namespace convsim::tests;
@@ -7,7 +9,7 @@ using namespace convsim::tests;
 testbench::testbench(sc_module_name name) : testbench(name, false, false) {
 }
 
-testbench::testbench(sc_module_name name, bool first, bool last) {
+testbench::testbench(sc_module_name name, bool first, bool last) : passed(false) {
     wait_start = !first;
     trigger_stop = last;
 
@@ -18,10 +20,13 @@ testbench::testbench(sc_module_name name, bool first, bool last) {
 void testbench::run_thread() {
     if (wait_start) wait(*start);
 
-    sc_time start_time = sc_time_stamp();
+    start_time = sc_time_stamp();
     bool success = run();
     sc_time end_time = sc_time_stamp();
 
+    passed = success;
+    elapsed = end_time - start_time;
+
     if (success) {
         cerr << "Testbench " << name() << " PASSED in " << end_time - start_time << endl << endl;
     } else {
@@ -239,3 +244,87 @@ bool pe_cluster_conv1::run() {
 
     return true;
 }
+
+fifo_microbench::fifo_microbench(sc_core::sc_module_name name) : fifo_microbench(name, false, false) {
+
+}
+
+fifo_microbench::fifo_microbench(sc_core::sc_module_name name, bool first, bool last) : testbench(name, first, last),
+                                                        ref_fifo(depth), fast_fifo("fast_fifo", depth), ref_events(0), fast_events(0) {
+
+    // one event monitor per channel, so that both pay the same monitoring overhead
+    {
+        sc_spawn_options opts;
+        opts.spawn_method();
+        opts.dont_initialize();
+        opts.set_sensitivity(&ref_fifo.data_written_event());
+        opts.set_sensitivity(&ref_fifo.data_read_event());
+
+        sc_spawn(bind(&fifo_microbench::count_events, this, &ref_events), 0, &opts);
+    }
+
+    {
+        sc_spawn_options opts;
+        opts.spawn_method();
+        opts.dont_initialize();
+        opts.set_sensitivity(&fast_fifo.data_written_event());
+        opts.set_sensitivity(&fast_fifo.data_read_event());
+
+        sc_spawn(bind(&fifo_microbench::count_events, this, &fast_events), 0, &opts);
+    }
+
+}
+
+void fifo_microbench::producer_thread(sc_fifo_out_if<uint32_t> *out) {
+
+    for (size_t i = 0; i < elements; i++) {
+        out->write(i);
+        wait(1);
+    }
+
+}
+
+void fifo_microbench::consumer_thread(sc_fifo_in_if<uint32_t> *in) {
+
+    wait(consumer_lag);
+
+    for (size_t i = 0; i < elements; i++) {
+        uint32_t val = in->read();
+        assert(val == i);
+        wait(1);
+    }
+
+}
+
+void fifo_microbench::count_events(uint64_t *events) {
+    (*events)++;
+}
+
+void fifo_microbench::measure(const char *label, sc_fifo_in_if<uint32_t> &in, sc_fifo_out_if<uint32_t> &out,
+                              const uint64_t &events) {
+    const uint64_t start_events = events;
+    const uint64_t start_deltas = sc_delta_count();
+    const auto start_wall = chrono::steady_clock::now();
+
+    sc_spawn_options opts;
+    opts.set_sensitivity(&clk.pos());
+
+    sc_spawn(bind(&fifo_microbench::producer_thread, this, &out), 0, &opts);
+    sc_process_handle consumer = sc_spawn(bind(&fifo_microbench::consumer_thread, this, &in), 0, &opts);
+
+    wait(consumer.terminated_event());
+
+    const chrono::duration<double, milli> wall = chrono::steady_clock::now() - start_wall;
+
+    cerr << "Microbenchmark " << label << ": " << elements << " elements, " << events - start_events << " event wakeups, "
+         << sc_delta_count() - start_deltas << " delta cycles, " << wall.count() << " ms" << endl;
+}
+
+bool fifo_microbench::run() {
+    wait(1);
+
+    measure("sc_fifo", ref_fifo, ref_fifo, ref_events);
+    measure("spsc_fifo", fast_fifo, fast_fifo, fast_events);
+
+    return true;
+}
@@ -1,9 +1,19 @@
 #pragma once
 
 #include <systemc>
+#include <algorithm>
 #include <array>
+#include <memory>
+#include <random>
+#include <vector>
 
+#include "cdc_fifo.h"
+#include "common.h"
+#include "partition.h"
+#include "psum_buffer.h"
+#include "reference.h"
 #include "row_stationary.h"
+#include "spsc_fifo.h"
 
 namespace convsim {
 namespace tests {
@@ -19,12 +29,17 @@ SC_MODULE(testbench) {
 
     sc_event *start;
     sc_event end;
+    bool passed;
+    sc_time elapsed;
 
     virtual bool run() = 0;
 
 protected:
     void aux_thread_wait();
 
+    // when run() was called
+    sc_time start_time;
+
 private:
     void run_thread();
 
@@ -107,5 +122,1243 @@ private:
     array<fifo, cols> psum_out_fifo;
 };
 
+// common part of the testbenches that stream a layer through Rows x Cols clusters: the layer data, a global buffer
+// thread per iact bank and weight row writing a precomputed stream, a thread per PE column reading psums and
+// checking them against the expected ones, and the psum spill path of multi-pass layers
+// fixtures only build their topology and the streams of their clusters
+template <typename W_t, typename IAct_t, typename PSum_t, size_t Rows, size_t Cols>
+struct cluster_testbench : testbench {
+protected:
+    static constexpr size_t banks = Rows + Cols - 1;
+
+public:
+    typedef convsim::row_stationary::pe_cluster<W_t, IAct_t, PSum_t, Rows, Cols, banks> cluster;
+
+    // psum spill path counters, over all the columns
+    uint64_t spilled_psums() const;
+    uint64_t reinjected_psums() const;
+    size_t peak_spill_occupancy() const;
+
+protected:
+    // expected psum, unless it belongs to a padding channel or filter (then it is dropped)
+    struct psum_check {
+        bool check;
+        PSum_t value;
+    };
+
+    // what the global buffer sends to a cluster, and the psums it expects back
+    struct streams {
+        array<vector<IAct_t>, banks> iact;
+        array<vector<W_t>, Rows> weight;
+        array<vector<psum_check>, Cols> psum;
+        // the iact streams are sent this many times over (e.g. once per filter)
+        size_t iact_repeat = 1;
+    };
+
+    cluster_testbench(sc_module_name name, bool first, bool last, const convsim::reference::conv_shape &shape);
+
+    // random ifmap and kernel_size weights, over the full range of each type
+    void random_data(unsigned seed, size_t kernel_size);
+
+    // a feeder thread per non-empty iact and weight stream and a checker thread per non-empty psum stream, all
+    // clocked by clk
+    void spawn_streams(sc_in<bool> &clk, streams s, array<sc_fifo<IAct_t>, banks> &iact_out,
+                       array<sc_fifo<W_t>, Rows> &weight_out, array<sc_fifo<PSum_t>, Cols> &psum_in);
+
+    // binds psum_in of c to psum_in_fifo and psum_out to psum_out_fifo, through a psum_spill_buffer per column when
+    // there are several passes of psums_per_pass psums each
+    void connect_psums(cluster &c, size_t psums_per_pass, size_t passes);
+
+    // waits for all the checkers, and sets elapsed already, so that run() can report statistics
+    void wait_checkers();
+
+    double elapsed_cycles() const {
+        return elapsed / convsim::clock_period(clk);
+    }
+
+    // where the i-th psum read from column col belongs, for error messages
+    virtual string psum_position(size_t col, size_t i) const;
+
+    convsim::reference::conv_shape shape;
+    vector<IAct_t> ifmap;
+    vector<W_t> kernel;
+    vector<PSum_t> ofmap;
+    size_t mismatches;
+
+    array<sc_fifo<PSum_t>, Cols> psum_in_fifo;
+    array<sc_fifo<PSum_t>, Cols> psum_out_fifo;
+    vector<unique_ptr<convsim::psum_spill_buffer<PSum_t>>> spill;
+    array<sc_fifo<PSum_t>, Cols> spill_fifo;
+
+private:
+    template <typename T>
+    void feed_thread(sc_fifo_out_if<T> *out, const vector<T> *stream, size_t repeat);
+    void check_thread(sc_fifo_in_if<PSum_t> *in, size_t col, const vector<psum_check> *expected);
+
+    vector<unique_ptr<streams>> spawned;
+    size_t checkers;
+    sc_event_queue read_done;
+};
+
+// single channel 2D convolution on a Rows x Cols cluster, with random data checked against the reference engine
+// PE (r, c) convolves ifmap row r + c with kernel row r, so column c produces ofmap row c
+// a batch of images is streamed back to back for each filter in turn, so that weights stay resident in the PEs
+// across the whole batch: psums come out tagged by filter and image in the same order
+// input channels are accumulated over passes, one per channel, with the psums of each pass spilled to a
+// psum_spill_buffer per column and reinjected on the next pass: they enter the bottom PE row and the idle rows below
+// a short kernel pass them up to the bottom row of the mapping, so any kernel height works with any channel count
+template <typename W_t, typename IAct_t, typename PSum_t, size_t Rows, size_t Cols>
+struct pe_cluster_conv : cluster_testbench<W_t, IAct_t, PSum_t, Rows, Cols> {
+    typedef cluster_testbench<W_t, IAct_t, PSum_t, Rows, Cols> base;
+    typedef typename base::cluster cluster;
+
+    pe_cluster_conv(sc_module_name name, bool first, bool last, const convsim::reference::conv_shape &shape,
+                    unsigned seed, const typename cluster::fifo_depths &depths = typename cluster::fifo_depths(),
+                    bool double_buffer_weights = false);
+
+    virtual bool run() override;
+
+    vector<convsim::fifo_stats> collect_fifo_stats() const {
+        return c.collect_fifo_stats();
+    }
+
+    // weights loaded by the PEs
+    uint64_t weight_loads() const {
+        return c.weight_loads();
+    }
+
+    // cycles the PEs waited for weights, over all the PEs
+    double weight_stall_cycles() const {
+        return c.weight_stall() / convsim::clock_period(this->clk);
+    }
+
+    static bool fits(const convsim::reference::conv_shape &shape) {
+        return shape.valid() && shape.stride == 1 && shape.kernel_h <= Rows && shape.ofmap_h() <= Cols;
+    }
+
+    // cycles the bottom row of the mapping waited for reinjected psums
+    double reinjection_stall_cycles() const;
+
+protected:
+    virtual string psum_position(size_t col, size_t i) const override;
+
+private:
+    using base::banks;
+    using base::shape;
+    using base::ifmap;
+    using base::kernel;
+    using base::ofmap;
+
+    cluster c;
+    array<sc_fifo<IAct_t>, banks> iact_fifo;
+    array<sc_fifo<W_t>, Rows> weight_fifo;
+};
+
+// one router hop between the global buffer and the PE array: port src is forwarded to port dst, the other ports
+// are tied to idle fifos
+template <typename T>
+struct noc_hop {
+    convsim::router<T> r;
+    array<sc_fifo<T>, convsim::N_DIRECTIONS> idle;
+
+    noc_hop(const char *name, sc_in<bool> &clk, convsim::direction src, sc_fifo_in_if<T> &in,
+            convsim::direction dst, sc_fifo_out_if<T> &out);
+};
+
+// pe_cluster_conv with the global buffer and the NoC in their own clock domain (noc_clk): data goes from the global
+// buffer through a router hop and a clock domain crossing into the cluster, psums come back the same way
+template <typename W_t, typename IAct_t, typename PSum_t, size_t Rows, size_t Cols>
+struct clock_domain_conv : cluster_testbench<W_t, IAct_t, PSum_t, Rows, Cols> {
+    typedef cluster_testbench<W_t, IAct_t, PSum_t, Rows, Cols> base;
+    typedef typename base::cluster cluster;
+
+    // NoC and global buffer clock
+    sc_in<bool> noc_clk;
+
+    clock_domain_conv(sc_module_name name, bool first, bool last, const convsim::reference::conv_shape &shape,
+                      unsigned seed, size_t sync_stages = 2);
+
+    virtual bool run() override;
+
+    // endless rows, so a single image, filter and channel: there is no spill path
+    static bool fits(const convsim::reference::conv_shape &shape) {
+        return shape.batch == 1 && shape.filters == 1 && shape.channels == 1 &&
+               pe_cluster_conv<W_t, IAct_t, PSum_t, Rows, Cols>::fits(shape);
+    }
+
+    // per-domain utilization, over the elapsed time of the testbench
+    double array_cycles() const;
+    double noc_cycles() const;
+    uint64_t noc_flits() const;
+    // busy cycles over available cycles of all the PEs
+    double pe_utilization() const;
+    // flits over available cycles of the router hops that carried any
+    double noc_utilization() const;
+
+private:
+    using base::banks;
+    using base::shape;
+    using base::ifmap;
+    using base::kernel;
+    using base::ofmap;
+
+    template <typename T>
+    static void make_crossings(vector<unique_ptr<convsim::cdc_fifo<T>>> &v, const char *kind, size_t n,
+                               size_t sync_stages);
+
+    cluster c;
+    // global buffer side
+    array<sc_fifo<IAct_t>, banks> glb_iact;
+    array<sc_fifo<W_t>, Rows> glb_weight;
+    array<sc_fifo<PSum_t>, Cols> glb_psum;
+    // clock domain crossings
+    vector<unique_ptr<convsim::cdc_fifo<IAct_t>>> iact_cdc;
+    vector<unique_ptr<convsim::cdc_fifo<W_t>>> weight_cdc;
+    vector<unique_ptr<convsim::cdc_fifo<PSum_t>>> psum_cdc;
+    // NoC
+    vector<unique_ptr<noc_hop<IAct_t>>> iact_hops;
+    vector<unique_ptr<noc_hop<W_t>>> weight_hops;
+    vector<unique_ptr<noc_hop<PSum_t>>> psum_hops;
+};
+
+// layer types with a dedicated pe_cluster mapping mode
+typedef enum {
+    DEPTHWISE, POINTWISE, FULLY_CONNECTED
+} layer_kind;
+
+// depthwise, pointwise and fully-connected layers on a Rows x Cols cluster, each with its own mapping mode
+// - depthwise: channels side by side in groups of ofmap_h columns, and stacked in groups of kernel_h rows, as many
+//   rounds as needed for all the channels (see depthwise_mapping)
+// - pointwise: input channels split in a chunk per row, each PE reducing its chunk of a pixel as a filter row,
+//   and filters on the columns (in rounds, if there are more than the columns); the pixels of all the images are
+//   streamed one after the other
+// - fully-connected: pointwise on 1x1 ifmaps, features as channels and the batch as pixels
+// with double buffered weights, the PEs load the weights of the next round while the current one is in use
+// the global buffer streams of every bank, weight row and column are precomputed, with partial channel and filter
+// groups padded with zeros (their psums are dropped)
+template <typename W_t, typename IAct_t, typename PSum_t, size_t Rows, size_t Cols>
+struct pe_cluster_layer : cluster_testbench<W_t, IAct_t, PSum_t, Rows, Cols> {
+    typedef cluster_testbench<W_t, IAct_t, PSum_t, Rows, Cols> base;
+    typedef typename base::cluster cluster;
+
+    pe_cluster_layer(sc_module_name name, bool first, bool last, layer_kind kind,
+                     const convsim::reference::conv_shape &shape, unsigned seed,
+                     const typename cluster::fifo_depths &depths = typename cluster::fifo_depths(),
+                     bool double_buffer_weights = false);
+
+    virtual bool run() override;
+
+    static bool fits(layer_kind kind, const convsim::reference::conv_shape &shape);
+
+    // useful multiply-accumulates of the layer
+    size_t macs() const;
+    // useful multiply-accumulates over available PE cycles
+    double mac_utilization() const;
+
+    // cycles the PEs waited for weights, over all the PEs
+    double weight_stall_cycles() const {
+        return c.weight_stall() / convsim::clock_period(this->clk);
+    }
+
+private:
+    using base::banks;
+    using base::shape;
+    using base::ifmap;
+    using base::kernel;
+    using base::ofmap;
+
+    typedef typename base::streams streams;
+
+    void map_depthwise(streams &st);
+    void map_pointwise(streams &st);
+
+    layer_kind kind;
+    bool double_buffer_weights;
+
+    cluster c;
+    array<sc_fifo<IAct_t>, banks> iact_fifo;
+    array<sc_fifo<W_t>, Rows> weight_fifo;
+};
+
+// a convolution with its input channels spread over a chain of clusters, one channel each and all with the same
+// dense conv_mapping: the bottom row of every cluster but the first accumulates the psums of the previous one,
+// which come through a partition_link per column, and the last cluster produces the ofmap
+// every cluster, with its global buffer feeders, is a partition: only the local ones are elaborated, so that a
+// partitioned run simulates one cluster per process (the one with the last cluster checks the psums)
+template <typename W_t, typename IAct_t, typename PSum_t, size_t Rows, size_t Cols>
+struct cluster_chain_conv : cluster_testbench<W_t, IAct_t, PSum_t, Rows, Cols> {
+    typedef cluster_testbench<W_t, IAct_t, PSum_t, Rows, Cols> base;
+    typedef typename base::cluster cluster;
+
+    // links between consecutive clusters, one per column, over a partition per cluster: to be created before
+    // forking the partitions
+    // the links are point-to-point, from a column's psum_out straight to the same column's psum_in in the next
+    // cluster, rather than through per-cluster routers (router_cluster): a chain only ever talks to its neighbour,
+    // so a router would just add its hop to the link latency, which the latency of the links stands for
+    struct chain_links {
+        chain_links(convsim::partition_set &parts, size_t latency, size_t depth = 16);
+
+        convsim::partition_link<PSum_t> &at(size_t cluster, size_t col) {
+            return *links[cluster * Cols + col];
+        }
+
+        convsim::partition_set &parts;
+        const size_t latency;
+
+    private:
+        vector<unique_ptr<convsim::partition_link<PSum_t>>> links;
+    };
+
+    cluster_chain_conv(sc_module_name name, bool first, bool last, const convsim::reference::conv_shape &shape,
+                       unsigned seed, chain_links &links);
+
+    virtual bool run() override;
+
+    static bool fits(const convsim::reference::conv_shape &shape) {
+        return shape.valid() && shape.stride == 1 && shape.kernel_h <= Rows && shape.ofmap_h() <= Cols;
+    }
+
+protected:
+    virtual string psum_position(size_t col, size_t i) const override;
+
+private:
+    using base::banks;
+    using base::shape;
+    using base::ifmap;
+    using base::kernel;
+    using base::ofmap;
+
+    // a cluster with its global buffer fifos and its ends of the links
+    struct stage {
+        explicit stage(const string &name) : c(name.c_str()) {
+        }
+
+        cluster c;
+        array<sc_fifo<IAct_t>, banks> iact_fifo;
+        array<sc_fifo<W_t>, Rows> weight_fifo;
+        // psum_in of the first cluster, psum_out of the last one
+        array<sc_fifo<PSum_t>, Cols> psum_in_fifo;
+        array<sc_fifo<PSum_t>, Cols> psum_out_fifo;
+        vector<unique_ptr<convsim::link_rx<PSum_t>>> rx;
+        vector<unique_ptr<convsim::link_tx<PSum_t>>> tx;
+    };
+
+    chain_links &links;
+
+    // local clusters only
+    vector<unique_ptr<stage>> stages;
+};
+
+// runs pe_cluster_conv on a Rows x Cols array with random shapes and data, comparing every output bit-exactly with
+// the reference engine, and checks the vectorised reference variants against the scalar oracle on the same shapes
+// and data (with strides 1 and 2, and as depthwise convolutions)
+template <size_t Rows, size_t Cols>
+struct pe_cluster_fuzz : testbench {
+    pe_cluster_fuzz(sc_module_name name, bool first, bool last, size_t n_trials = 16, unsigned seed = 1);
+    ~pe_cluster_fuzz();
+
+    virtual bool run() override;
+
+    size_t trials_run() const { return trials.size(); }
+    size_t trials_passed() const;
+    // shapes on which a vectorised reference variant disagreed with the scalar oracle
+    size_t reference_mismatches() const { return bad_references; }
+
+private:
+    static constexpr size_t max_kernel_w = 5;
+    // wide enough rows on large arrays for the reference engine to fill its vector lanes
+    static constexpr size_t max_ofmap_w = max<size_t>(12, 2 * Cols);
+    static constexpr size_t max_batch = 3;
+    static constexpr size_t max_filters = 2;
+    static constexpr size_t max_channels = 3;
+
+    // narrow psums, so that overflows are exercised too
+    typedef uint8_t W_t;
+    typedef uint8_t IAct_t;
+    typedef uint16_t PSum_t;
+    typedef pe_cluster_conv<W_t, IAct_t, PSum_t, Rows, Cols> trial;
+
+    static bool reference_matches(const convsim::reference::conv_shape &shape, unsigned seed);
+
+    vector<trial *> trials;
+    size_t bad_references;
+    sc_event kick;
+};
+
+struct fifo_microbench : testbench {
+    SC_CTOR(fifo_microbench);
+    fifo_microbench(sc_module_name name, bool first, bool last);
+
+    virtual bool run() override;
+
+private:
+    static constexpr size_t depth = 16;
+    static constexpr size_t elements = 100000;
+    // the consumer starts late, so that the fifo level settles in the middle
+    static constexpr size_t consumer_lag = depth / 4;
+
+    void producer_thread(sc_fifo_out_if<uint32_t> *out);
+    void consumer_thread(sc_fifo_in_if<uint32_t> *in);
+    void count_events(uint64_t *events);
+    void measure(const char *label, sc_fifo_in_if<uint32_t> &in, sc_fifo_out_if<uint32_t> &out, const uint64_t &events);
+
+    sc_fifo<uint32_t> ref_fifo;
+    convsim::spsc_fifo<uint32_t, depth> fast_fifo;
+    uint64_t ref_events;
+    uint64_t fast_events;
+};
+
+template <typename W_t, typename IAct_t, typename PSum_t, size_t Rows, size_t Cols>
+cluster_testbench<W_t, IAct_t, PSum_t, Rows, Cols>::cluster_testbench(sc_module_name name, bool first, bool last,
+                                                                      const convsim::reference::conv_shape &shape)
+    : testbench(name, first, last), shape(shape), mismatches(0), checkers(0) {
+}
+
+template <typename W_t, typename IAct_t, typename PSum_t, size_t Rows, size_t Cols>
+void cluster_testbench<W_t, IAct_t, PSum_t, Rows, Cols>::random_data(unsigned seed, size_t kernel_size) {
+    mt19937 rng(seed);
+
+    ifmap.resize(shape.ifmap_size());
+    kernel.resize(kernel_size);
+
+    for (auto &v : ifmap) v = static_cast<IAct_t>(rng());
+    for (auto &v : kernel) v = static_cast<W_t>(rng());
+}
+
+template <typename W_t, typename IAct_t, typename PSum_t, size_t Rows, size_t Cols>
+void cluster_testbench<W_t, IAct_t, PSum_t, Rows, Cols>::spawn_streams(sc_in<bool> &clk, streams s,
+                                                                       array<sc_fifo<IAct_t>, banks> &iact_out,
+                                                                       array<sc_fifo<W_t>, Rows> &weight_out,
+                                                                       array<sc_fifo<PSum_t>, Cols> &psum_in) {
+    // the threads read the streams until the end of the simulation
+    spawned.emplace_back(new streams(move(s)));
+    const streams &st = *spawned.back();
+
+    for (size_t i = 0; i < Rows; ++i) {
+        if (st.weight[i].empty()) continue;
+
+        sc_spawn_options opts;
+        opts.set_sensitivity(&clk.pos());
+
+        sc_spawn(bind(&cluster_testbench::feed_thread<W_t>, this, &weight_out[i], &st.weight[i], 1), 0, &opts);
+    }
+
+    for (size_t i = 0; i < banks; ++i) {
+        if (st.iact[i].empty()) continue;
+
+        sc_spawn_options opts;
+        opts.set_sensitivity(&clk.pos());
+
+        sc_spawn(bind(&cluster_testbench::feed_thread<IAct_t>, this, &iact_out[i], &st.iact[i], st.iact_repeat), 0,
+                 &opts);
+    }
+
+    for (size_t i = 0; i < Cols; ++i) {
+        if (st.psum[i].empty()) continue;
+
+        sc_spawn_options opts;
+        opts.set_sensitivity(&clk.pos());
+
+        sc_spawn(bind(&cluster_testbench::check_thread, this, &psum_in[i], i, &st.psum[i]), 0, &opts);
+        checkers++;
+    }
+}
+
+template <typename W_t, typename IAct_t, typename PSum_t, size_t Rows, size_t Cols>
+template <typename T>
+void cluster_testbench<W_t, IAct_t, PSum_t, Rows, Cols>::feed_thread(sc_fifo_out_if<T> *out, const vector<T> *stream,
+                                                                     size_t repeat) {
+    aux_thread_wait();
+
+    for (size_t k = 0; k < repeat; k++) {
+        for (auto &v : *stream) out->write(v);
+    }
+}
+
+template <typename W_t, typename IAct_t, typename PSum_t, size_t Rows, size_t Cols>
+void cluster_testbench<W_t, IAct_t, PSum_t, Rows, Cols>::check_thread(sc_fifo_in_if<PSum_t> *in, size_t col,
+                                                                      const vector<psum_check> *expected) {
+    aux_thread_wait();
+
+    for (size_t i = 0; i < expected->size(); i++) {
+        const PSum_t val = in->read();
+        const psum_check &e = (*expected)[i];
+
+        if (e.check && val != e.value) {
+            if (mismatches == 0) {
+                cerr << "Testbench " << name() << ": " << psum_position(col, i) << " is " << +val << ", expected "
+                     << +e.value << endl;
+            }
+
+            mismatches++;
+        }
+    }
+
+    read_done.notify(SC_ZERO_TIME);
+}
+
+template <typename W_t, typename IAct_t, typename PSum_t, size_t Rows, size_t Cols>
+string cluster_testbench<W_t, IAct_t, PSum_t, Rows, Cols>::psum_position(size_t col, size_t i) const {
+    return "psum " + to_string(i) + " of column " + to_string(col);
+}
+
+template <typename W_t, typename IAct_t, typename PSum_t, size_t Rows, size_t Cols>
+void cluster_testbench<W_t, IAct_t, PSum_t, Rows, Cols>::wait_checkers() {
+    for (size_t i = 0; i < checkers; ++i) {
+        wait(read_done.default_event());
+    }
+
+    // run_thread sets it again once run() returns
+    elapsed = sc_time_stamp() - start_time;
+}
+
+template <typename W_t, typename IAct_t, typename PSum_t, size_t Rows, size_t Cols>
+void cluster_testbench<W_t, IAct_t, PSum_t, Rows, Cols>::connect_psums(cluster &c, size_t psums_per_pass,
+                                                                       size_t passes) {
+    for (size_t i = 0; i < Cols; i++) c.psum_in[i](psum_in_fifo[i]);
+
+    if (passes == 1) {
+        for (size_t i = 0; i < Cols; i++) c.psum_out[i](psum_out_fifo[i]);
+        return;
+    }
+
+    for (size_t i = 0; i < Cols; i++) {
+        const string name = "spill_" + to_string(i);
+        spill.emplace_back(new convsim::psum_spill_buffer<PSum_t>(name.c_str()));
+
+        spill[i]->clk(clk);
+        c.psum_out[i](spill_fifo[i]);
+        spill[i]->spill_in(spill_fifo[i]);
+        spill[i]->reinject_out(psum_in_fifo[i]);
+        spill[i]->result_out(psum_out_fifo[i]);
+        spill[i]->set_config(psums_per_pass, passes);
+    }
+}
+
+template <typename W_t, typename IAct_t, typename PSum_t, size_t Rows, size_t Cols>
+uint64_t cluster_testbench<W_t, IAct_t, PSum_t, Rows, Cols>::spilled_psums() const {
+    uint64_t n = 0;
+    for (auto &b : spill) n += b->spilled();
+    return n;
+}
+
+template <typename W_t, typename IAct_t, typename PSum_t, size_t Rows, size_t Cols>
+uint64_t cluster_testbench<W_t, IAct_t, PSum_t, Rows, Cols>::reinjected_psums() const {
+    uint64_t n = 0;
+    for (auto &b : spill) n += b->reinjected();
+    return n;
+}
+
+template <typename W_t, typename IAct_t, typename PSum_t, size_t Rows, size_t Cols>
+size_t cluster_testbench<W_t, IAct_t, PSum_t, Rows, Cols>::peak_spill_occupancy() const {
+    size_t peak = 0;
+    for (auto &b : spill) peak = max(peak, b->peak_occupancy());
+    return peak;
+}
+
+template <typename W_t, typename IAct_t, typename PSum_t, size_t Rows, size_t Cols>
+pe_cluster_conv<W_t, IAct_t, PSum_t, Rows, Cols>::pe_cluster_conv(sc_module_name name, bool first, bool last,
+                                                                  const convsim::reference::conv_shape &shape,
+                                                                  unsigned seed,
+                                                                  const typename cluster::fifo_depths &depths,
+                                                                  bool double_buffer_weights)
+    : base(name, first, last, shape), c("c", depths) {
+
+    if (!fits(shape)) {
+        throw runtime_error(string(this->name()) + " convolution doesn't fit the PE cluster");
+    }
+
+    c.clk(this->clk);
+
+    for (size_t i = 0; i < banks; i++) c.iact_in[i](iact_fifo[i]);
+    for (size_t i = 0; i < Rows; i++) c.weight_in[i](weight_fifo[i]);
+
+    this->connect_psums(c, shape.batch * shape.ofmap_w(), shape.channels);
+
+    typename cluster::config cfg = cluster::conv_mapping(shape.kernel_h, shape.kernel_w, shape.ofmap_h(),
+                                                         shape.ifmap_w);
+    cfg.pe_config.batch = shape.batch;
+    cfg.pe_config.passes = shape.channels;
+    cfg.pe_config.double_buffer_weights = double_buffer_weights;
+    cfg.pe_config.weight_rows = shape.filters * shape.channels;
+
+    c.set_config(cfg);
+
+    this->random_data(seed, shape.weight_size());
+
+    // the reference variants are checked against the scalar oracle by pe_cluster_fuzz
+    ofmap = convsim::reference::conv2d_direct<W_t, IAct_t, PSum_t>(shape, ifmap, kernel);
+
+    typename base::streams s;
+
+    for (size_t row = 0; row < shape.kernel_h; row++) {
+        for (size_t m = 0; m < shape.filters; m++) {
+            for (size_t ch = 0; ch < shape.channels; ch++) {
+                const W_t *kernel_row = &kernel[((m * shape.channels + ch) * shape.kernel_h + row) * shape.kernel_w];
+                s.weight[row].insert(s.weight[row].end(), kernel_row, kernel_row + shape.kernel_w);
+            }
+        }
+    }
+
+    // the ifmap rows of all the channels and images are sent again for every filter
+    s.iact_repeat = shape.filters;
+
+    for (size_t bank = 0; bank < shape.ifmap_h; bank++) {
+        for (size_t ch = 0; ch < shape.channels; ch++) {
+            for (size_t n = 0; n < shape.batch; n++) {
+                const IAct_t *ifmap_row = &ifmap[((n * shape.channels + ch) * shape.ifmap_h + bank) * shape.ifmap_w];
+                s.iact[bank].insert(s.iact[bank].end(), ifmap_row, ifmap_row + shape.ifmap_w);
+            }
+        }
+    }
+
+    for (size_t col = 0; col < shape.ofmap_h(); col++) {
+        for (size_t m = 0; m < shape.filters; m++) {
+            for (size_t n = 0; n < shape.batch; n++) {
+                const PSum_t *ofmap_row = &ofmap[((n * shape.filters + m) * shape.ofmap_h() + col) * shape.ofmap_w()];
+
+                for (size_t o_c = 0; o_c < shape.ofmap_w(); o_c++) s.psum[col].push_back({true, ofmap_row[o_c]});
+            }
+        }
+    }
+
+    this->spawn_streams(this->clk, move(s), iact_fifo, weight_fifo, this->psum_out_fifo);
+}
+
+template <typename W_t, typename IAct_t, typename PSum_t, size_t Rows, size_t Cols>
+string pe_cluster_conv<W_t, IAct_t, PSum_t, Rows, Cols>::psum_position(size_t col, size_t i) const {
+    // psums of a column come filter by filter, image by image
+    const size_t o_c = i % shape.ofmap_w();
+    const size_t n = i / shape.ofmap_w() % shape.batch;
+    const size_t m = i / (shape.ofmap_w() * shape.batch);
+
+    return to_string(shape.batch) + "x" + to_string(shape.channels) + "x" + to_string(shape.ifmap_h) + "x" +
+           to_string(shape.ifmap_w) + " ifmap, " + to_string(shape.filters) + "x" + to_string(shape.channels) + "x" +
+           to_string(shape.kernel_h) + "x" + to_string(shape.kernel_w) + " kernel: ofmap[" + to_string(n) + "][" +
+           to_string(m) + "][" + to_string(col) + "][" + to_string(o_c) + "]";
+}
+
+template <typename W_t, typename IAct_t, typename PSum_t, size_t Rows, size_t Cols>
+bool pe_cluster_conv<W_t, IAct_t, PSum_t, Rows, Cols>::run() {
+    wait(1);
+
+    this->wait_checkers();
+
+    // every image gets a psum per output pixel, filter and pass out of the cluster
+    const uint64_t expected = shape.filters * shape.channels * shape.ofmap_h() * shape.ofmap_w();
+    const vector<uint64_t> psums = c.psums_per_image();
+
+    for (size_t n = 0; n < shape.batch; n++) {
+        const uint64_t got = n < psums.size() ? psums[n] : 0;
+
+        if (got != expected) {
+            cerr << "Testbench " << this->name() << ": image " << n << " got " << got << " psums, expected "
+                 << expected << endl;
+            this->mismatches++;
+        }
+    }
+
+    if (!this->spill.empty()) {
+        cerr << "Psum spill " << this->name() << ": " << shape.channels << " passes, " << this->spilled_psums()
+             << " psums spilled, " << this->reinjected_psums() << " reinjected, up to "
+             << this->peak_spill_occupancy() << " buffered per column, " << reinjection_stall_cycles()
+             << " reinjection stall cycles" << endl;
+    }
+
+    return this->mismatches == 0;
+}
+
+template <typename W_t, typename IAct_t, typename PSum_t, size_t Rows, size_t Cols>
+double pe_cluster_conv<W_t, IAct_t, PSum_t, Rows, Cols>::reinjection_stall_cycles() const {
+    if (this->spill.empty()) return 0;
+
+    return c.psum_in_stall(shape.kernel_h - 1) / convsim::clock_period(this->clk);
+}
+
+template <typename T>
+noc_hop<T>::noc_hop(const char *name, sc_in<bool> &clk, convsim::direction src, sc_fifo_in_if<T> &in,
+                    convsim::direction dst, sc_fifo_out_if<T> &out) : r(name) {
+    typename convsim::router<T>::config cfg;
+    cfg.groupEnable(src, {static_cast<size_t>(dst)});
+    r.set_config(cfg);
+
+    r.clk(clk);
+
+    for (size_t d = 0; d < convsim::N_DIRECTIONS; d++) {
+        if (d == static_cast<size_t>(src)) r.in[d](in);
+        else r.in[d](idle[d]);
+
+        if (d == static_cast<size_t>(dst)) r.out[d](out);
+        else r.out[d](idle[d]);
+    }
+}
+
+template <typename W_t, typename IAct_t, typename PSum_t, size_t Rows, size_t Cols>
+template <typename T>
+void clock_domain_conv<W_t, IAct_t, PSum_t, Rows, Cols>::make_crossings(
+    vector<unique_ptr<convsim::cdc_fifo<T>>> &v, const char *kind, size_t n, size_t sync_stages) {
+    for (size_t i = 0; i < n; i++) {
+        const string name = string(kind) + "_cdc_" + to_string(i);
+        v.emplace_back(new convsim::cdc_fifo<T>(name.c_str(), 16, sync_stages));
+    }
+}
+
+template <typename W_t, typename IAct_t, typename PSum_t, size_t Rows, size_t Cols>
+clock_domain_conv<W_t, IAct_t, PSum_t, Rows, Cols>::clock_domain_conv(sc_module_name name, bool first, bool last,
+                                                                      const convsim::reference::conv_shape &shape,
+                                                                      unsigned seed, size_t sync_stages)
+    : base(name, first, last, shape), noc_clk("noc_clk"), c("c") {
+
+    if (!fits(shape)) {
+        throw runtime_error(string(this->name()) + " convolution doesn't fit the PE cluster");
+    }
+
+    make_crossings(iact_cdc, "iact", banks, sync_stages);
+    make_crossings(weight_cdc, "weight", Rows, sync_stages);
+    make_crossings(psum_cdc, "psum", Cols, sync_stages);
+
+    c.clk(this->clk);
+
+    // global buffer -> router -> crossing -> cluster
+    for (size_t i = 0; i < banks; i++) {
+        const string hop = "iact_hop_" + to_string(i);
+        iact_hops.emplace_back(new noc_hop<IAct_t>(hop.c_str(), noc_clk, GLB, glb_iact[i], PE, *iact_cdc[i]));
+        iact_cdc[i]->wr_clk(noc_clk);
+        iact_cdc[i]->rd_clk(this->clk);
+        c.iact_in[i](*iact_cdc[i]);
+    }
+
+    for (size_t i = 0; i < Rows; i++) {
+        const string hop = "weight_hop_" + to_string(i);
+        weight_hops.emplace_back(new noc_hop<W_t>(hop.c_str(), noc_clk, GLB, glb_weight[i], PE, *weight_cdc[i]));
+        weight_cdc[i]->wr_clk(noc_clk);
+        weight_cdc[i]->rd_clk(this->clk);
+        c.weight_in[i](*weight_cdc[i]);
+    }
+
+    // cluster -> crossing -> router -> global buffer
+    for (size_t i = 0; i < Cols; i++) {
+        const string hop = "psum_hop_" + to_string(i);
+        psum_hops.emplace_back(new noc_hop<PSum_t>(hop.c_str(), noc_clk, PE, *psum_cdc[i], GLB, glb_psum[i]));
+        psum_cdc[i]->wr_clk(this->clk);
+        psum_cdc[i]->rd_clk(noc_clk);
+        c.psum_out[i](*psum_cdc[i]);
+        c.psum_in[i](this->psum_in_fifo[i]);
+    }
+
+    // endless rows, as the iacts of a single image row are streamed
+    typename cluster::config cfg = cluster::conv_mapping(shape.kernel_h, shape.kernel_w, shape.ofmap_h(), 0);
+
+    c.set_config(cfg);
+
+    this->random_data(seed, shape.weight_size());
+    ofmap = convsim::reference::conv2d_direct<W_t, IAct_t, PSum_t>(shape, ifmap, kernel);
+
+    typename base::streams s;
+
+    for (size_t row = 0; row < shape.kernel_h; row++) {
+        s.weight[row].assign(&kernel[row * shape.kernel_w], &kernel[(row + 1) * shape.kernel_w]);
+    }
+
+    for (size_t bank = 0; bank < shape.ifmap_h; bank++) {
+        s.iact[bank].assign(&ifmap[bank * shape.ifmap_w], &ifmap[(bank + 1) * shape.ifmap_w]);
+    }
+
+    for (size_t col = 0; col < shape.ofmap_h(); col++) {
+        for (size_t o_c = 0; o_c < shape.ofmap_w(); o_c++) {
+            s.psum[col].push_back({true, ofmap[col * shape.ofmap_w() + o_c]});
+        }
+    }
+
+    // the global buffer runs in the NoC domain
+    this->spawn_streams(noc_clk, move(s), glb_iact, glb_weight, glb_psum);
+}
+
+template <typename W_t, typename IAct_t, typename PSum_t, size_t Rows, size_t Cols>
+bool clock_domain_conv<W_t, IAct_t, PSum_t, Rows, Cols>::run() {
+    wait(1);
+
+    this->wait_checkers();
+
+    cerr << "Clock domains " << this->name() << ": array " << array_cycles() << " cycles, "
+         << 100 * pe_utilization() << "% PE utilization; NoC " << noc_cycles() << " cycles, " << noc_flits()
+         << " flits, " << 100 * noc_utilization() << "% router utilization" << endl;
+
+    return this->mismatches == 0;
+}
+
+template <typename W_t, typename IAct_t, typename PSum_t, size_t Rows, size_t Cols>
+double clock_domain_conv<W_t, IAct_t, PSum_t, Rows, Cols>::array_cycles() const {
+    return this->elapsed_cycles();
+}
+
+template <typename W_t, typename IAct_t, typename PSum_t, size_t Rows, size_t Cols>
+double clock_domain_conv<W_t, IAct_t, PSum_t, Rows, Cols>::noc_cycles() const {
+    return this->elapsed / convsim::clock_period(noc_clk);
+}
+
+template <typename W_t, typename IAct_t, typename PSum_t, size_t Rows, size_t Cols>
+uint64_t clock_domain_conv<W_t, IAct_t, PSum_t, Rows, Cols>::noc_flits() const {
+    uint64_t flits = 0;
+
+    for (auto &h : iact_hops) flits += h->r.flits();
+    for (auto &h : weight_hops) flits += h->r.flits();
+    for (auto &h : psum_hops) flits += h->r.flits();
+
+    return flits;
+}
+
+template <typename W_t, typename IAct_t, typename PSum_t, size_t Rows, size_t Cols>
+double clock_domain_conv<W_t, IAct_t, PSum_t, Rows, Cols>::pe_utilization() const {
+    const double cycles = array_cycles();
+    return cycles > 0 ? c.busy_cycles() / (cycles * Rows * Cols) : 0;
+}
+
+template <typename W_t, typename IAct_t, typename PSum_t, size_t Rows, size_t Cols>
+double clock_domain_conv<W_t, IAct_t, PSum_t, Rows, Cols>::noc_utilization() const {
+    size_t active = 0;
+
+    for (auto &h : iact_hops) active += h->r.flits() > 0;
+    for (auto &h : weight_hops) active += h->r.flits() > 0;
+    for (auto &h : psum_hops) active += h->r.flits() > 0;
+
+    const double cycles = noc_cycles();
+    return cycles > 0 && active > 0 ? noc_flits() / (cycles * active) : 0;
+}
+
+template <typename W_t, typename IAct_t, typename PSum_t, size_t Rows, size_t Cols>
+bool pe_cluster_layer<W_t, IAct_t, PSum_t, Rows, Cols>::fits(layer_kind kind,
+                                                             const convsim::reference::conv_shape &shape) {
+    if (!shape.valid() || shape.stride != 1) return false;
+
+    switch (kind) {
+    case DEPTHWISE:
+        return shape.batch == 1 && shape.kernel_h <= Rows && shape.ofmap_h() <= Cols;
+    case POINTWISE:
+        return shape.kernel_h == 1 && shape.kernel_w == 1;
+    case FULLY_CONNECTED:
+        return shape.kernel_h == 1 && shape.kernel_w == 1 && shape.ifmap_h == 1 && shape.ifmap_w == 1;
+    }
+
+    return false;
+}
+
+template <typename W_t, typename IAct_t, typename PSum_t, size_t Rows, size_t Cols>
+pe_cluster_layer<W_t, IAct_t, PSum_t, Rows, Cols>::pe_cluster_layer(sc_module_name name, bool first, bool last,
+                                                                    layer_kind kind,
+                                                                    const convsim::reference::conv_shape &shape,
+                                                                    unsigned seed,
+                                                                    const typename cluster::fifo_depths &depths,
+                                                                    bool double_buffer_weights)
+    : base(name, first, last, shape), kind(kind), double_buffer_weights(double_buffer_weights), c("c", depths) {
+
+    if (!fits(kind, shape)) {
+        throw runtime_error(string(this->name()) + " layer doesn't fit the PE cluster");
+    }
+
+    c.clk(this->clk);
+
+    for (size_t i = 0; i < banks; i++) c.iact_in[i](iact_fifo[i]);
+    for (size_t i = 0; i < Rows; i++) c.weight_in[i](weight_fifo[i]);
+
+    this->random_data(seed, kind == DEPTHWISE ? shape.channels * shape.kernel_h * shape.kernel_w
+                                              : shape.weight_size());
+
+    streams s;
+
+    if (kind == DEPTHWISE) {
+        ofmap = convsim::reference::conv2d_depthwise<W_t, IAct_t, PSum_t>(shape, ifmap, kernel);
+        map_depthwise(s);
+    } else {
+        ofmap = convsim::reference::conv2d_direct<W_t, IAct_t, PSum_t>(shape, ifmap, kernel);
+        map_pointwise(s);
+    }
+
+    this->spawn_streams(this->clk, move(s), iact_fifo, weight_fifo, this->psum_out_fifo);
+}
+
+template <typename W_t, typename IAct_t, typename PSum_t, size_t Rows, size_t Cols>
+void pe_cluster_layer<W_t, IAct_t, PSum_t, Rows, Cols>::map_depthwise(streams &st) {
+    const size_t C = shape.channels;
+    const size_t H = shape.ifmap_h, W = shape.ifmap_w;
+    const size_t R = shape.kernel_h, S = shape.kernel_w;
+    const size_t E = shape.ofmap_h(), F = shape.ofmap_w();
+    const size_t columns = cluster::depthwise_columns(E);
+    const size_t stack = cluster::depthwise_stack(R, S);
+    const size_t groups = columns * stack;
+    const size_t rounds = (C + groups - 1) / groups;
+
+    this->connect_psums(c, F, 1);
+
+    typename cluster::config cfg = cluster::depthwise_mapping(R, S, E, W);
+    cfg.pe_config.double_buffer_weights = double_buffer_weights;
+    cfg.pe_config.weight_rows = rounds;
+    c.set_config(cfg);
+
+    // the groups fed by each bank (in lane order) and the ifmap row they take from it
+    array<vector<pair<size_t, size_t>>, banks> fed;
+
+    for (size_t q = 0; q < groups; q++) {
+        for (size_t h = 0; h < H; h++) fed[cluster::depthwise_bank(R, E, q, h)].push_back({q, h});
+    }
+
+    for (auto &f : fed) sort(f.begin(), f.end());
+
+    for (size_t k = 0; k < rounds; k++) {
+        // a shared bank alternates its groups one iact at a time
+        for (size_t b = 0; b < banks; b++) {
+            for (size_t w = 0; w < W; w++) {
+                for (auto &f : fed[b]) {
+                    const size_t ch = k * groups + f.first;
+                    st.iact[b].push_back(ch < C ? ifmap[(ch * H + f.second) * W + w] : 0);
+                }
+            }
+        }
+
+        for (size_t q = 0; q < groups; q++) {
+            const size_t ch = k * groups + q;
+            const size_t v = q / columns;
+
+            for (size_t r = 0; r < R; r++) {
+                for (size_t s = 0; s < S; s++) {
+                    st.weight[v * R + r].push_back(ch < C ? kernel[(ch * R + r) * S + s] : 0);
+                }
+            }
+        }
+
+        // in each window the column sends out the psum of every stacked group, from the top one
+        for (size_t g = 0; g < columns; g++) {
+            for (size_t e = 0; e < E; e++) {
+                for (size_t f = 0; f < F; f++) {
+                    for (size_t v = 0; v < stack; v++) {
+                        const size_t ch = k * groups + v * columns + g;
+                        st.psum[g * E + e].push_back({ch < C, ch < C ? ofmap[(ch * E + e) * F + f] : PSum_t(0)});
+                    }
+                }
+            }
+        }
+    }
+}
+
+template <typename W_t, typename IAct_t, typename PSum_t, size_t Rows, size_t Cols>
+void pe_cluster_layer<W_t, IAct_t, PSum_t, Rows, Cols>::map_pointwise(streams &st) {
+    const size_t N = shape.batch, C = shape.channels, M = shape.filters;
+    const size_t HW = shape.ifmap_h * shape.ifmap_w;
+    const size_t pixels = N * HW;
+    // channels per row and filters per round
+    const size_t chunk = cluster::pointwise_chunk(C);
+    const size_t rows = cluster::pointwise_rows(C);
+    const size_t fpr = min(M, Cols);
+    const size_t rounds = (M + fpr - 1) / fpr;
+
+    this->connect_psums(c, pixels, 1);
+
+    typename cluster::config cfg = kind == FULLY_CONNECTED ? cluster::fully_connected_mapping(C, fpr, pixels)
+                                                           : cluster::pointwise_mapping(C, fpr, pixels);
+    cfg.pe_config.double_buffer_weights = double_buffer_weights;
+    cfg.pe_config.weight_rows = rounds;
+    c.set_config(cfg);
+
+    for (size_t k = 0; k < rounds; k++) {
+        for (size_t r = 0; r < rows; r++) {
+            // the chunk of every pixel, the last chunk padded
+            for (size_t n = 0; n < N; n++) {
+                for (size_t i = 0; i < HW; i++) {
+                    for (size_t j = 0; j < chunk; j++) {
+                        const size_t ch = r * chunk + j;
+                        st.iact[r].push_back(ch < C ? ifmap[(n * C + ch) * HW + i] : 0);
+                    }
+                }
+            }
+
+            // one filter row per column
+            for (size_t col = 0; col < fpr; col++) {
+                const size_t m = k * fpr + col;
+
+                for (size_t j = 0; j < chunk; j++) {
+                    const size_t ch = r * chunk + j;
+                    st.weight[r].push_back(ch < C && m < M ? kernel[m * C + ch] : 0);
+                }
+            }
+        }
+
+        for (size_t col = 0; col < fpr; col++) {
+            const size_t m = k * fpr + col;
+
+            for (size_t n = 0; n < N; n++) {
+                for (size_t i = 0; i < HW; i++) {
+                    st.psum[col].push_back({m < M, m < M ? ofmap[(n * M + m) * HW + i] : PSum_t(0)});
+                }
+            }
+        }
+    }
+}
+
+template <typename W_t, typename IAct_t, typename PSum_t, size_t Rows, size_t Cols>
+bool pe_cluster_layer<W_t, IAct_t, PSum_t, Rows, Cols>::run() {
+    wait(1);
+
+    this->wait_checkers();
+
+    static const char *kinds[] = {"depthwise", "pointwise", "fully-connected"};
+
+    cerr << "Mapping " << this->name() << ": " << kinds[kind] << " layer, " << macs() << " MACs, "
+         << 100 * mac_utilization() << "% MAC utilization" << endl;
+
+    return this->mismatches == 0;
+}
+
+template <typename W_t, typename IAct_t, typename PSum_t, size_t Rows, size_t Cols>
+size_t pe_cluster_layer<W_t, IAct_t, PSum_t, Rows, Cols>::macs() const {
+    // a depthwise layer has a single filter per channel
+    return kind == DEPTHWISE ? shape.macs() / shape.filters : shape.macs();
+}
+
+template <typename W_t, typename IAct_t, typename PSum_t, size_t Rows, size_t Cols>
+double pe_cluster_layer<W_t, IAct_t, PSum_t, Rows, Cols>::mac_utilization() const {
+    const double cycles = this->elapsed_cycles();
+    return cycles > 0 ? macs() / (cycles * Rows * Cols) : 0;
+}
+
+template <typename W_t, typename IAct_t, typename PSum_t, size_t Rows, size_t Cols>
+cluster_chain_conv<W_t, IAct_t, PSum_t, Rows, Cols>::chain_links::chain_links(convsim::partition_set &parts,
+                                                                             size_t latency, size_t depth)
+    : parts(parts), latency(latency) {
+    for (size_t k = 0; k + 1 < parts.size(); k++) {
+        for (size_t col = 0; col < Cols; col++) {
+            links.emplace_back(new convsim::partition_link<PSum_t>(parts, k, k + 1, latency, depth));
+        }
+    }
+}
+
+template <typename W_t, typename IAct_t, typename PSum_t, size_t Rows, size_t Cols>
+cluster_chain_conv<W_t, IAct_t, PSum_t, Rows, Cols>::cluster_chain_conv(sc_module_name name, bool first, bool last,
+                                                                        const convsim::reference::conv_shape &shape,
+                                                                        unsigned seed, chain_links &links)
+    : base(name, first, last, shape), links(links), stages(shape.channels) {
+
+    if (!fits(shape)) {
+        throw runtime_error(string(this->name()) + " convolution doesn't fit the PE clusters");
+    }
+
+    if (links.parts.size() != shape.channels) {
+        throw runtime_error(string(this->name()) + " needs a partition per input channel");
+    }
+
+    // every partition draws the same data
+    this->random_data(seed, shape.weight_size());
+
+    const size_t last_k = shape.channels - 1;
+
+    if (links.parts.local(last_k)) {
+        ofmap = convsim::reference::conv2d_direct<W_t, IAct_t, PSum_t>(shape, ifmap, kernel);
+    }
+
+    for (size_t k = 0; k < shape.channels; k++) {
+        if (!links.parts.local(k)) continue;
+
+        stages[k].reset(new stage("c_" + to_string(k)));
+        stage &st = *stages[k];
+
+        st.c.clk(this->clk);
+
+        for (size_t i = 0; i < banks; i++) st.c.iact_in[i](st.iact_fifo[i]);
+        for (size_t i = 0; i < Rows; i++) st.c.weight_in[i](st.weight_fifo[i]);
+
+        // the psums of column i reach the next cluster over their own point-to-point link, with no router in
+        // between (see chain_links)
+        for (size_t i = 0; i < Cols; i++) {
+            if (k == 0) {
+                st.c.psum_in[i](st.psum_in_fifo[i]);
+            } else {
+                const string rx_name = "rx_" + to_string(k) + "_" + to_string(i);
+                st.rx.emplace_back(new convsim::link_rx<PSum_t>(rx_name.c_str(), links.at(k - 1, i)));
+                st.rx[i]->clk(this->clk);
+                st.c.psum_in[i](*st.rx[i]);
+            }
+
+            if (k == last_k) {
+                st.c.psum_out[i](st.psum_out_fifo[i]);
+            } else {
+                const string tx_name = "tx_" + to_string(k) + "_" + to_string(i);
+                st.tx.emplace_back(new convsim::link_tx<PSum_t>(tx_name.c_str(), links.at(k, i)));
+                st.tx[i]->clk(this->clk);
+                st.c.psum_out[i](*st.tx[i]);
+            }
+        }
+
+        typename cluster::config cfg = cluster::conv_mapping(shape.kernel_h, shape.kernel_w, shape.ofmap_h(),
+                                                             shape.ifmap_w);
+        cfg.pe_config.batch = shape.batch;
+        cfg.psum_chain = k > 0;
+
+        st.c.set_config(cfg);
+
+        // channel k of every filter and image
+        typename base::streams s;
+
+        for (size_t row = 0; row < shape.kernel_h; row++) {
+            for (size_t m = 0; m < shape.filters; m++) {
+                const W_t *kernel_row = &kernel[((m * shape.channels + k) * shape.kernel_h + row) * shape.kernel_w];
+                s.weight[row].insert(s.weight[row].end(), kernel_row, kernel_row + shape.kernel_w);
+            }
+        }
+
+        s.iact_repeat = shape.filters;
+
+        for (size_t bank = 0; bank < shape.ifmap_h; bank++) {
+            for (size_t n = 0; n < shape.batch; n++) {
+                const IAct_t *ifmap_row = &ifmap[((n * shape.channels + k) * shape.ifmap_h + bank) * shape.ifmap_w];
+                s.iact[bank].insert(s.iact[bank].end(), ifmap_row, ifmap_row + shape.ifmap_w);
+            }
+        }
+
+        // only the last cluster produces the ofmap
+        for (size_t col = 0; k == last_k && col < shape.ofmap_h(); col++) {
+            for (size_t m = 0; m < shape.filters; m++) {
+                for (size_t n = 0; n < shape.batch; n++) {
+                    const PSum_t *ofmap_row =
+                        &ofmap[((n * shape.filters + m) * shape.ofmap_h() + col) * shape.ofmap_w()];
+
+                    for (size_t o_c = 0; o_c < shape.ofmap_w(); o_c++) s.psum[col].push_back({true, ofmap_row[o_c]});
+                }
+            }
+        }
+
+        this->spawn_streams(this->clk, move(s), st.iact_fifo, st.weight_fifo, st.psum_out_fifo);
+    }
+}
+
+template <typename W_t, typename IAct_t, typename PSum_t, size_t Rows, size_t Cols>
+string cluster_chain_conv<W_t, IAct_t, PSum_t, Rows, Cols>::psum_position(size_t col, size_t i) const {
+    const size_t o_c = i % shape.ofmap_w();
+    const size_t n = i / shape.ofmap_w() % shape.batch;
+    const size_t m = i / (shape.ofmap_w() * shape.batch);
+
+    return "ofmap[" + to_string(n) + "][" + to_string(m) + "][" + to_string(col) + "][" + to_string(o_c) + "]";
+}
+
+template <typename W_t, typename IAct_t, typename PSum_t, size_t Rows, size_t Cols>
+bool cluster_chain_conv<W_t, IAct_t, PSum_t, Rows, Cols>::run() {
+    wait(1);
+
+    size_t local = 0;
+    for (auto &st : stages) local += st != nullptr;
+
+    if (stages.back()) {
+        this->wait_checkers();
+    } else {
+        // this partition is done once its last cluster has sent all its psums down the chain
+        size_t k = stages.size() - 1;
+        while (!stages[k]) k--;
+
+        const uint64_t psums = shape.filters * shape.batch * shape.ofmap_w();
+
+        for (size_t i = 0; i < shape.ofmap_h(); ++i) {
+            const convsim::link_tx<PSum_t> &tx = *stages[k]->tx[i];
+            while (tx.sent() < psums) wait(tx.data_written_event());
+        }
+    }
+
+    cerr << "Cluster chain " << this->name() << ": " << shape.channels << " clusters (" << local
+         << " simulated here), " << links.latency << " cycles link latency" << endl;
+
+    return this->mismatches == 0;
+}
+
+template <size_t Rows, size_t Cols>
+pe_cluster_fuzz<Rows, Cols>::pe_cluster_fuzz(sc_module_name name, bool first, bool last, size_t n_trials,
+                                             unsigned seed)
+    : testbench(name, first, last), bad_references(0) {
+
+    mt19937 rng(seed);
+
+    for (size_t i = 0; i < n_trials; i++) {
+        convsim::reference::conv_shape shape;
+
+        // any kernel height with any number of channels: the spilled psums of multi-channel layers are passed up
+        // through the PE rows below short kernels
+        shape.channels = uniform_int_distribution<size_t>(1, max_channels)(rng);
+        shape.kernel_h = uniform_int_distribution<size_t>(1, Rows)(rng);
+        shape.kernel_w = uniform_int_distribution<size_t>(1, max_kernel_w)(rng);
+        shape.ifmap_h = shape.kernel_h + uniform_int_distribution<size_t>(0, Cols - 1)(rng);
+        shape.ifmap_w = shape.kernel_w + uniform_int_distribution<size_t>(0, max_ofmap_w - 1)(rng);
+        shape.batch = uniform_int_distribution<size_t>(1, max_batch)(rng);
+        shape.filters = uniform_int_distribution<size_t>(1, max_filters)(rng);
+
+        const unsigned data_seed = rng();
+
+        if (!reference_matches(shape, data_seed)) bad_references++;
+
+        const string name = "trial_" + to_string(i);
+        // every other trial with double-buffered weights
+        trial *t = new trial(name.c_str(), false, false, shape, data_seed, typename trial::cluster::fifo_depths(),
+                             i % 2 == 1);
+
+        t->clk(clk);
+        // trials run one after the other
+        t->start = i == 0 ? &kick : &trials.back()->end;
+
+        trials.push_back(t);
+    }
+}
+
+template <size_t Rows, size_t Cols>
+pe_cluster_fuzz<Rows, Cols>::~pe_cluster_fuzz() {
+    for_each(trials.begin(), trials.end(), default_delete<trial>());
+}
+
+template <size_t Rows, size_t Cols>
+bool pe_cluster_fuzz<Rows, Cols>::reference_matches(const convsim::reference::conv_shape &shape, unsigned seed) {
+    namespace ref = convsim::reference;
+
+    mt19937 rng(seed);
+    vector<IAct_t> ifmap(shape.ifmap_size());
+    vector<W_t> weights(shape.weight_size());
+
+    for (auto &v : ifmap) v = static_cast<IAct_t>(rng());
+    for (auto &v : weights) v = static_cast<W_t>(rng());
+
+    // one R x S kernel per channel
+    const vector<W_t> dw_weights(weights.begin(), weights.begin() + shape.channels * shape.kernel_h * shape.kernel_w);
+
+    for (size_t stride : {1, 2}) {
+        ref::conv_shape s = shape;
+        s.stride = stride;
+
+        const vector<PSum_t> oracle = ref::conv2d_scalar<W_t, IAct_t, PSum_t>(s, ifmap, weights);
+        const vector<PSum_t> dw_oracle = ref::conv2d_scalar<W_t, IAct_t, PSum_t>(s, ifmap, dw_weights, true);
+
+        if (ref::conv2d_direct<W_t, IAct_t, PSum_t>(s, ifmap, weights) != oracle ||
+            ref::conv2d_im2col<W_t, IAct_t, PSum_t>(s, ifmap, weights) != oracle ||
+            ref::conv2d_depthwise<W_t, IAct_t, PSum_t>(s, ifmap, dw_weights) != dw_oracle) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+template <size_t Rows, size_t Cols>
+size_t pe_cluster_fuzz<Rows, Cols>::trials_passed() const {
+    return count_if(trials.begin(), trials.end(), [](trial *t) { return t->passed; });
+}
+
+template <size_t Rows, size_t Cols>
+bool pe_cluster_fuzz<Rows, Cols>::run() {
+    wait(1);
+
+    if (!trials.empty()) {
+        kick.notify();
+        wait(trials.back()->end);
+    }
+
+    cerr << "Fuzzer " << name() << ": " << trials_passed() << "/" << trials.size() << " trials passed, "
+         << trials.size() - bad_references << "/" << trials.size()
+         << " shapes with the reference variants matching the scalar oracle" << endl;
+
+    return trials_passed() == trials.size() && bad_references == 0;
+}
+
 }
 }